@@ -133,6 +133,8 @@ int main(int argc,char** argv)
     code_t  code;
     number_map_t    vars;
     stack_t stack;
+    // dup, variables and literals share limbs until they change
+    xbmath::memory_scope cow(&xbmath::shared_limbs::resource);
 
     try {
 	work_name = "reading data";
@@ -174,7 +176,7 @@ void instruction::exec(stack_t&   stack,number_map_t& map) const
 	break;
     case store_var:
 	test_stack(stack);
-	map[text] = stack.top();
+	map[text].swap(stack.top());
 	stack.pop();
 	break;
     case load:
@@ -190,65 +192,55 @@ void instruction::exec(stack_t&   stack,number_map_t& map) const
 	break;
     case add:
 	{
+	    // b is taken off the stack by swapping, a changes in place
 	    test_stack(stack);
-	    number_t b	= stack.top();	 stack.pop();
+	    number_t b;	 b.swap(stack.top());	 stack.pop();
 	    test_stack(stack);
-		     b += stack.top();	 stack.pop();
-	    stack.push( b );
+	    stack.top() += b;
 	}
 	break;
     case mul:
 	{
 	    test_stack(stack);
-	    number_t b	= stack.top();	 stack.pop();
+	    number_t b;	 b.swap(stack.top());	 stack.pop();
 	    test_stack(stack);
-		     b *= stack.top();	 stack.pop();
-	    stack.push( b );
+	    stack.top() *= b;
 	}
 	break;
     case sub:
 	{
 	    test_stack(stack);
-	    number_t b	= stack.top();	 stack.pop();
+	    number_t b;	 b.swap(stack.top());	 stack.pop();
 	    test_stack(stack);
-	    number_t a	= stack.top();	 stack.pop();
-	    a -= b;
-	    stack.push( a );
+	    stack.top() -= b;
 	}
 	break;
     case div:
 	{
 	    test_stack(stack);
-	    number_t b	= stack.top();	 stack.pop();
+	    number_t b;	 b.swap(stack.top());	 stack.pop();
 	    test_stack(stack);
-	    number_t a	= stack.top();	 stack.pop();
 	    if( b.is_zero() )
 		throw "division by zero";
-	    a.div(b);
-	    stack.push( a );
+	    stack.top().div(b);
 	}
 	break;
     case mod:
 	{
 	    test_stack(stack);
-	    number_t b	= stack.top();	 stack.pop();
+	    number_t b;	 b.swap(stack.top());	 stack.pop();
 	    test_stack(stack);
-	    number_t a	= stack.top();	 stack.pop();
 	    if( b.is_zero() )
 		throw "division by zero";
-
-	    a.mod(b);
-	    stack.push( a );
+	    stack.top().mod(b);
 	}
 	break;
     case pow:
 	{
 	    test_stack(stack);
-	    number_t b	= stack.top();	 stack.pop();
+	    number_t b;	 b.swap(stack.top());	 stack.pop();
 	    test_stack(stack);
-	    number_t a	= stack.top();	 stack.pop();
-	    a.pow( b );
-	    stack.push( a );
+	    stack.top().pow( b );
 	}
 	break;
     case chs:
@@ -0,0 +1,2364 @@
+/*
+* File		: xbkernel.cpp
+* Language	: C++
+* Author	: Zbigniew Zagorski <longmanz@polbox.com>
+* Description	: C++ Big number mathematic routines.
+
+	Low level routines operating on raw atom arrays (class kernel).
+	
+	Changes:
+	    
+*
+* Copyright
+
+This software is Copyright(c) Zbigniew Zagorski, 2001.
+All rights reserved, and is distributed as free software under the
+following license.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+- Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+
+- Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+
+- Neither name of the copyright holders nor the names of its
+contributors may be used to endorse or promote products derived from
+this software without specific prior written permission.
+
+- Any commercial use of this software without specific prior written
+permission is not allowed.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND THE CONTRIBUTORS
+"AS IS" AND ANY EXPRESSED OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+HOLDERS OR THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "xbmath.h"
+#include <vector>
+#include <deque>
+#include <math.h>
+#include <new>
+#if __cplusplus >= 201103L
+#include <mutex>
+#endif
+
+#if	defined __clang__ || (defined __GNUC__ && __GNUC__ >= 5)
+#define XBM_HAVE_ADD_OVERFLOW
+#endif
+
+typedef xbmath::atom		atom;
+typedef xbmath::kernel::size_type	size_type;
+
+xbmath::kernel::size_type xbmath::kernel::karatsuba_threshold = 32;
+xbmath::kernel::size_type xbmath::kernel::toom3_threshold = 150;
+xbmath::kernel::size_type xbmath::kernel::toom4_threshold = 400;
+xbmath::kernel::size_type xbmath::kernel::fft_threshold = 10000;
+xbmath::kernel::size_type xbmath::kernel::sqr_karatsuba_threshold = 48;
+xbmath::kernel::size_type xbmath::kernel::sqr_toom3_threshold = 200;
+xbmath::kernel::size_type xbmath::kernel::sqr_toom4_threshold = 500;
+xbmath::kernel::size_type xbmath::kernel::sqr_fft_threshold = 12000;
+xbmath::kernel::size_type xbmath::kernel::div_bz_threshold = 60;
+xbmath::kernel::size_type xbmath::kernel::div_newton_threshold = 30000;
+xbmath::kernel::size_type xbmath::kernel::divexact_threshold = 150;
+xbmath::kernel::size_type xbmath::kernel::str_dc_threshold = 20;
+
+/*
+    Scratch space. Each thread keeps a stack of chunks: allocations
+    bump the top chunk, one that does not fit pushes a chunk at least
+    twice the size, and a chunk popped when its scope ends is kept as
+    the spare for the next push. After a few calls of a kind the
+    chunks hold all their temporaries and nothing is allocated.
+*/
+struct xbmath::kernel::scratch::chunk {
+    chunk*	prev;
+    size_type	size;	// atoms after the header
+    size_type	used;
+    size_type	align;	// keeps the atoms 16 byte aligned
+    atom* data() { return (atom*)(this + 1); }
+};
+
+typedef xbmath::kernel::scratch::chunk scratch_chunk;
+
+struct scratch_stack {
+    scratch_chunk* top;		// only the bottom one may be idle
+    scratch_chunk* spare;
+#if __cplusplus >= 201103L
+    ~scratch_stack() { xbmath::kernel::scratch::release(); }
+#endif
+};
+
+static XBM_THREAD_LOCAL scratch_stack scratch_thread;
+
+enum { scratch_min = 4096 };
+
+static scratch_chunk* scratch_take(scratch_stack& s,size_type n,size_type want)
+/* the spare if it holds n atoms, else a new chunk of want */
+{
+    scratch_chunk* k = s.spare;
+    if( k && k->size >= n ) {
+	s.spare = NULL;
+	return k;
+    }
+    k = (scratch_chunk*)malloc(sizeof(scratch_chunk) + want*sizeof(atom));
+    if( k == NULL )
+	throw std::bad_alloc();
+    k->size = want;
+    k->used = 0;
+    return k;
+}
+
+xbmath::kernel::scratch::scratch(size_type n)
+{
+    scratch_stack& s = scratch_thread;
+    chunk* k = s.top;
+    if( k == NULL || (k->used == 0 && k->size < n) ) {
+	// the bottom chunk is idle, it is replaced by a bigger one
+	const size_type m = k ? 2*k->size : scratch_min;
+	free(k);
+	k = scratch_take(s,n,n > m ? n : m);
+	k->prev = NULL;
+	s.top = k;
+    }
+    top = k;
+    if( k->size - k->used < n ) {
+	chunk* x = scratch_take(s,n,n > 2*k->size ? n : 2*k->size);
+	x->prev = k;
+	s.top = k = x;
+    }
+    c = k;
+    used = k->used;
+    p = k->data() + k->used;
+    k->used += n;
+}
+
+xbmath::kernel::scratch::~scratch()
+{
+    c->used = used;
+    if( c != top ) {
+	scratch_stack& s = scratch_thread;
+	s.top = top;
+	if( s.spare == NULL || s.spare->size < c->size ) {
+	    free(s.spare);
+	    s.spare = c;
+	} else
+	    free(c);
+    }
+}
+
+void xbmath::kernel::scratch::reserve(size_type n)
+{
+    scratch_stack& s = scratch_thread;
+    if( s.top == NULL || (s.top->used == 0 && s.top->size < n) ) {
+	free(s.top);
+	s.top = scratch_take(s,n,n > (size_type)scratch_min ? n : (size_type)scratch_min);
+	s.top->prev = NULL;
+    }
+}
+
+void xbmath::kernel::scratch::release()
+{
+    scratch_stack& s = scratch_thread;
+    assert( s.top == NULL || s.top->used == 0 );
+    free(s.top);
+    free(s.spare);
+    s.top = s.spare = NULL;
+}
+
+/* Temporary atom array used by recursive algorithms. */
+typedef xbmath::kernel::scratch tmp_atoms;
+
+/* r = a + b + cf, cf is updated to carry out (0 or 1) */
+static inline atom atom_addc(atom a,atom b,atom& cf)
+{
+#ifdef XBM_HAVE_ADD_OVERFLOW
+    atom s;
+    atom c1 = __builtin_add_overflow(a,b,&s);
+    atom c2 = __builtin_add_overflow(s,cf,&s);
+    cf = c1 | c2;
+    return s;
+#else
+    atom s = a + b;
+    atom c1 = s < a;
+    s += cf;
+    cf = c1 | (s < cf);
+    return s;
+#endif
+}
+
+/* r = a - b - cf, cf is updated to borrow out (0 or 1) */
+static inline atom atom_subc(atom a,atom b,atom& cf)
+{
+#ifdef XBM_HAVE_ADD_OVERFLOW
+    atom s;
+    atom c1 = __builtin_sub_overflow(a,b,&s);
+    atom c2 = __builtin_sub_overflow(s,cf,&s);
+    cf = c1 | c2;
+    return s;
+#else
+    atom s = a - b;
+    atom c1 = s > a;
+    atom t = s - cf;
+    cf = c1 | (t > s);
+    return t;
+#endif
+}
+
+/* low atom of a * b + c + d, high atom stored in hi; never overflows */
+static inline atom atom_muladd(atom a,atom b,atom c,atom d,atom& hi)
+{
+#ifdef XBM_HAVE_DOUBLE_ATOM
+    xbmath::double_atom t = (xbmath::double_atom)a * b + c + d;
+    hi = (atom)(t >> xbmath::atom_bits);
+    return (atom)t;
+#else
+    const int half = xbmath::atom_bits / 2;
+    const atom mask = (((atom)1) << half) - 1;
+    atom al = a & mask, ah = a >> half;
+    atom bl = b & mask, bh = b >> half;
+    atom ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+    atom mid = (ll >> half) + (lh & mask) + (hl & mask);
+    atom lo = (ll & mask) | (mid << half);
+    hi = hh + (lh >> half) + (hl >> half) + (mid >> half);
+    atom cf = 0;
+    lo = atom_addc(lo,c,cf);
+    hi += cf; cf = 0;
+    lo = atom_addc(lo,d,cf);
+    hi += cf;
+    return lo;
+#endif
+}
+
+/* number of leading zero bits, x != 0 */
+static inline unsigned atom_clz(atom x)
+{
+#if	defined __GNUC__
+    if( sizeof(atom) == sizeof(unsigned long) )
+	return __builtin_clzl(x);
+    return __builtin_clzll(x);
+#else
+    unsigned n = 0;
+    while( !(x & xbmath::last_bit) ) {
+	x <<= 1;
+	++n;
+    }
+    return n;
+#endif
+}
+
+static inline unsigned atom_ctz(atom x)
+{
+#if	defined __GNUC__
+    if( sizeof(atom) == sizeof(unsigned long) )
+	return __builtin_ctzl(x);
+    return __builtin_ctzll(x);
+#else
+    unsigned n = 0;
+    while( !(x & xbmath::first_bit) ) {
+	x >>= 1;
+	++n;
+    }
+    return n;
+#endif
+}
+
+/* (hi*B + lo) / d, requires hi < d; remainder stored in rem */
+static inline atom atom_div(atom hi,atom lo,atom d,atom& rem)
+{
+#ifdef XBM_HAVE_DOUBLE_ATOM
+    xbmath::double_atom n = ((xbmath::double_atom)hi << xbmath::atom_bits) | lo;
+    atom q = (atom)(n / d);
+    rem = lo - q * d;
+    return q;
+#else
+    // normalize d and divide by half atoms (Knuth D with two digits)
+    const int half = xbmath::atom_bits / 2;
+    const atom b = ((atom)1) << half;
+    unsigned s = atom_clz(d);
+    if( s ) {
+	d <<= s;
+	hi = (hi << s) | (lo >> (xbmath::atom_bits - s));
+	lo <<= s;
+    }
+    atom dh = d >> half, dl = d & (b - 1);
+    atom lh = lo >> half, ll = lo & (b - 1);
+
+    atom q1 = hi / dh, rh = hi - q1 * dh;
+    while( q1 >= b || q1 * dl > ((rh << half) | lh) ) {
+	--q1;
+	rh += dh;
+	if( rh >= b )
+	    break;
+    }
+    atom un21 = (hi << half) + lh - q1 * d;
+    atom q0 = un21 / dh;
+    rh = un21 - q0 * dh;
+    while( q0 >= b || q0 * dl > ((rh << half) | ll) ) {
+	--q0;
+	rh += dh;
+	if( rh >= b )
+	    break;
+    }
+    rem = ((un21 << half) + ll - q0 * d) >> s;
+    return (q1 << half) | q0;
+#endif
+}
+
+atom xbmath::kernel::add_1(atom* r,const atom* a,size_type n,atom b)
+{
+    size_type i = 0;
+    for( ; i < n; ++i ) {
+	atom t = a[i] + b;
+	r[i] = t;
+	if( t >= b ) {	// no carry, copy the rest
+	    b = 0;
+	    ++i;
+	    break;
+	}
+	b = 1;
+    }
+    if( r != a )
+	for( ; i < n; ++i )
+	    r[i] = a[i];
+    return b;
+}
+
+atom xbmath::kernel::add_n(atom* r,const atom* a,const atom* b,size_type n)
+{
+    atom cf = 0;
+    for( size_type i = 0; i < n; ++i )
+	r[i] = atom_addc(a[i],b[i],cf);
+    return cf;
+}
+
+atom xbmath::kernel::add(atom* r,const atom* a,size_type an,const atom* b,size_type bn)
+{
+    atom cf = add_n(r,a,b,bn);
+    return add_1(r+bn,a+bn,an-bn,cf);
+}
+
+atom xbmath::kernel::sub_1(atom* r,const atom* a,size_type n,atom b)
+{
+    size_type i = 0;
+    for( ; i < n; ++i ) {
+	atom x = a[i];
+	r[i] = x - b;
+	if( x >= b ) {	// no borrow, copy the rest
+	    b = 0;
+	    ++i;
+	    break;
+	}
+	b = 1;
+    }
+    if( r != a )
+	for( ; i < n; ++i )
+	    r[i] = a[i];
+    return b;
+}
+
+atom xbmath::kernel::sub_n(atom* r,const atom* a,const atom* b,size_type n)
+{
+    atom cf = 0;
+    for( size_type i = 0; i < n; ++i )
+	r[i] = atom_subc(a[i],b[i],cf);
+    return cf;
+}
+
+atom xbmath::kernel::sub(atom* r,const atom* a,size_type an,const atom* b,size_type bn)
+{
+    atom cf = sub_n(r,a,b,bn);
+    return sub_1(r+bn,a+bn,an-bn,cf);
+}
+
+atom xbmath::kernel::mul_1(atom* r,const atom* a,size_type n,atom b)
+{
+    atom carry = 0;
+    for( size_type i = 0; i < n; ++i )
+	r[i] = atom_muladd(a[i],b,carry,0,carry);
+    return carry;
+}
+
+atom xbmath::kernel::addmul_1(atom* r,const atom* a,size_type n,atom b)
+{
+    atom carry = 0;
+    for( size_type i = 0; i < n; ++i )
+	r[i] = atom_muladd(a[i],b,r[i],carry,carry);
+    return carry;
+}
+
+atom xbmath::kernel::submul_1(atom* r,const atom* a,size_type n,atom b)
+{
+    atom carry = 0;
+    for( size_type i = 0; i < n; ++i ) {
+	atom hi;
+	atom lo = atom_muladd(a[i],b,carry,0,hi);
+	atom x = r[i];
+	r[i] = x - lo;
+	carry = hi + (x < lo);
+    }
+    return carry;
+}
+
+void xbmath::kernel::mul_basecase(atom* r,const atom* a,size_type an,const atom* b,size_type bn)
+{
+    r[an] = mul_1(r,a,an,b[0]);
+    for( size_type j = 1; j < bn; ++j )
+	r[an+j] = addmul_1(r+j,a,an,b[j]);
+}
+
+void xbmath::kernel::sqr_basecase(atom* r,const atom* a,size_type n)
+/*
+    Cross products a[i]*a[j], i < j, are computed once and doubled,
+    then the diagonal a[i]^2 is added.
+*/
+{
+    if( n == 1 ) {
+	r[0] = atom_muladd(a[0],a[0],0,0,r[1]);
+	return;
+    }
+    r[0] = 0;
+    r[n] = mul_1(r+1,a+1,n-1,a[0]);
+    for( size_type i = 1; i < n-1; ++i )
+	r[n+i] = addmul_1(r+2*i+1,a+i+1,n-i-1,a[i]);
+    r[2*n-1] = 0;
+    lshift(r,r,2*n,1);
+    atom cf = 0;
+    for( size_type i = 0; i < n; ++i ) {
+	atom hi;
+	atom lo = atom_muladd(a[i],a[i],0,0,hi);
+	r[2*i]   = atom_addc(r[2*i],lo,cf);
+	r[2*i+1] = atom_addc(r[2*i+1],hi,cf);
+    }
+}
+
+/*
+    Helpers for Karatsuba and Toom-Cook.
+
+    Toom interpolation works on signed values stored in two's
+    complement in fixed width arrays, so all arithmetic below is
+    modulo B^n and the intermediate sign never has to be tracked.
+*/
+
+/* r = a * b for any sizes, operands may have leading zeros;
+   r has an+bn atoms */
+static void mul_any(atom* r,const atom* a,size_type an,const atom* b,size_type bn)
+{
+    size_type n = an + bn;
+    an = xbmath::kernel::normalize(a,an);
+    bn = xbmath::kernel::normalize(b,bn);
+    if( an == 0 || bn == 0 ) {
+	memset(r,0,n*sizeof(atom));
+	return;
+    }
+    if( a == b && an == bn )
+	xbmath::kernel::sqr(r,a,an);
+    else if( an >= bn )
+	xbmath::kernel::mul(r,a,an,b,bn);
+    else
+	xbmath::kernel::mul(r,b,bn,a,an);
+    memset(r+an+bn,0,(n-an-bn)*sizeof(atom));
+}
+
+/* r = |a - b|, an >= bn, r has an atoms; returns true if a < b */
+static bool abs_diff(atom* r,const atom* a,size_type an,const atom* b,size_type bn)
+{
+    bool a_less = xbmath::kernel::normalize(a+bn,an-bn) == 0 &&
+	xbmath::kernel::cmp(a,b,bn) < 0;
+    if( a_less ) {
+	xbmath::kernel::sub_n(r,b,a,bn);
+	memset(r+bn,0,(an-bn)*sizeof(atom));
+    } else
+	xbmath::kernel::sub(r,a,an,b,bn);
+    return a_less;
+}
+
+/* r[0..rn) += c[0..cn) << (off atoms); the sum must fit in rn atoms */
+static void add_at(atom* r,size_type rn,size_type off,const atom* c,size_type cn)
+{
+    cn = xbmath::kernel::normalize(c,cn);
+    if( cn == 0 )
+	return;
+    assert( off + cn <= rn );
+    atom cf = xbmath::kernel::add(r+off,r+off,rn-off,c,cn);
+    assert( cf == 0 );
+    (void)cf;
+}
+
+static void tc_neg(atom* r,size_type n)
+{
+    for( size_type i = 0; i < n; ++i )
+	r[i] = ~r[i];
+    xbmath::kernel::add_1(r,r,n,1);
+}
+
+/* arithmetic shift right by s bits (0 < s < atom_bits) */
+static void tc_sar(atom* r,size_type n,unsigned s)
+{
+    bool neg = (r[n-1] >> (xbmath::atom_bits-1)) != 0;
+    xbmath::kernel::rshift(r,r,n,s);
+    if( neg )
+	r[n-1] |= ~(~(atom)0 >> s);
+}
+
+/* inverse of odd d modulo B */
+static atom binvert(atom d)
+{
+    atom inv = d;			// correct to 3 bits
+    for( unsigned bits = 3; bits < xbmath::atom_bits; bits *= 2 )
+	inv *= 2 - d * inv;
+    return inv;
+}
+
+/* r = r / d, d odd, division known to be exact (Hensel) */
+static void tc_divexact(atom* r,size_type n,atom d)
+{
+    atom inv = binvert(d);
+    atom c = 0;
+    for( size_type i = 0; i < n; ++i ) {
+	atom x = r[i];
+	atom s = x - c;
+	atom borrow = s > x;
+	atom q = s * inv;
+	r[i] = q;
+	atom hi;
+	atom_muladd(q,d,0,0,hi);
+	c = hi + borrow;
+    }
+}
+
+static void mul_karatsuba(atom* r,const atom* a,size_type an,const atom* b,size_type bn)
+/*
+    an >= bn > h, h = ceil(an/2)
+    a = a1*B^h + a0,  b = b1*B^h + b0
+    a*b = a1b1*B^2h + (a0b0 + a1b1 - (a0-a1)(b0-b1))*B^h + a0b0
+*/
+{
+    const size_type h = (an + 1) / 2;
+    const size_type n1 = an - h;
+    const size_type m1 = bn - h;
+    tmp_atoms t(6*h + 1);
+    atom* da  = t;
+    atom* db  = da + h;
+    atom* mid = db + h;
+    atom* w   = mid + 2*h;
+
+    bool sub_mid = abs_diff(da,a,h,a+h,n1) == abs_diff(db,b,h,b+h,m1);
+    xbmath::kernel::mul(r,a,h,b,h);
+    xbmath::kernel::mul(r+2*h,a+h,n1,b+h,m1);
+    mul_any(mid,da,h,db,h);
+
+    w[2*h] = xbmath::kernel::add(w,r,2*h,r+2*h,n1+m1);
+    if( sub_mid )
+	xbmath::kernel::sub(w,w,2*h+1,mid,2*h);
+    else
+	xbmath::kernel::add(w,w,2*h+1,mid,2*h);
+    add_at(r,an+bn,h,w,2*h+1);
+}
+
+static void sqr_karatsuba(atom* r,const atom* a,size_type n)
+/*
+    a = a1*B^h + a0
+    a^2 = a1^2*B^2h + (a0^2 + a1^2 - (a0-a1)^2)*B^h + a0^2
+*/
+{
+    const size_type h = (n + 1) / 2;
+    const size_type n1 = n - h;
+    tmp_atoms t(5*h + 1);
+    atom* da  = t;
+    atom* mid = da + h;
+    atom* w   = mid + 2*h;
+
+    abs_diff(da,a,h,a+h,n1);
+    xbmath::kernel::sqr(r,a,h);
+    xbmath::kernel::sqr(r+2*h,a+h,n1);
+    mul_any(mid,da,h,da,h);
+
+    w[2*h] = xbmath::kernel::add(w,r,2*h,r+2*h,2*n1);
+    xbmath::kernel::sub(w,w,2*h+1,mid,2*h);
+    add_at(r,2*n,h,w,2*h+1);
+}
+
+/* Evaluation points for 4, 5 and 7 point Toom.
+   At 1/2 the value is scaled by 2^(m-1) to stay integer. */
+enum { toom_half = 100, toom_inf = 101 };
+static const int toom_points4[4] = { 0, 1, -1, toom_inf };
+static const int toom_points5[5] = { 0, 1, -1, 2, toom_inf };
+static const int toom_points7[7] = { 0, 1, -1, 2, -2, toom_half, toom_inf };
+
+/* coefficient of part i of m at point x */
+static int toom_coef(int x,int i,int m)
+{
+    if( x == toom_inf )
+	return i == m-1;
+    if( x == toom_half )
+	return 1 << (m-1-i);
+    int c = 1;
+    while( i-- > 0 )
+	c *= x;
+    return c;
+}
+
+/* v = value at point x of the polynomial with m parts of k atoms of x;
+   stores |v| in ln atoms and returns true if v < 0 */
+static bool toom_eval(atom* v,size_type ln,const atom* x,size_type xn,size_type k,int m,int point)
+{
+    memset(v,0,ln*sizeof(atom));
+    for( int i = 0; i < m; ++i ) {
+	int coef = toom_coef(point,i,m);
+	if( coef == 0 || i*k >= xn )
+	    continue;
+	const atom* part = x + i*k;
+	size_type pn = xn - i*k < k ? xn - i*k : k;
+	if( coef > 0 ) {
+	    atom c = xbmath::kernel::addmul_1(v,part,pn,coef);
+	    xbmath::kernel::add_1(v+pn,v+pn,ln-pn,c);
+	} else {
+	    atom c = xbmath::kernel::submul_1(v,part,pn,-coef);
+	    xbmath::kernel::sub_1(v+pn,v+pn,ln-pn,c);
+	}
+    }
+    bool neg = (v[ln-1] >> (xbmath::atom_bits-1)) != 0;
+    if( neg )
+	tc_neg(v,ln);
+    return neg;
+}
+
+static void mul_toom(atom* r,const atom* a,size_type an,const atom* b,size_type bn,int m,int mb)
+/*
+    Toom-m.mb: a in m parts and b in mb parts of k atoms,
+    m + mb - 1 points (4, 5 or 7). Toom-3 is 3.3, Toom-4 is 4.4,
+    Toom-3.2 and Toom-4.2 serve unbalanced operands.
+*/
+{
+    const size_type k  = (an + m - 1) / m;
+    const size_type ln = k + 2;		// evaluated operand
+    const size_type L  = 2*k + 3;	// product, signed
+    const int np = m + mb - 1;
+    const int* points = (np == 4) ? toom_points4 :
+	(np == 5) ? toom_points5 : toom_points7;
+    const bool square = (a == b && an == bn);
+    assert( bn <= mb*k );
+
+    tmp_atoms t(np*L + 4*ln);
+    atom* W  = t;
+    atom* va = W + np*L;
+    atom* vb = va + ln;
+    atom* pr = vb + ln;		// 2*ln atoms
+
+    for( int j = 0; j < np; ++j ) {
+	bool neg = toom_eval(va,ln,a,an,k,m,points[j]);
+	if( square )
+	    neg = false;
+	else
+	    neg ^= toom_eval(vb,ln,b,bn,k,mb,points[j]);
+	mul_any(pr,va,ln,square ? va : vb,ln);
+	assert( pr[2*ln-1] == 0 );
+	memcpy(W + j*L,pr,L*sizeof(atom));
+	if( neg )
+	    tc_neg(W + j*L,L);
+    }
+
+    atom* c[7];
+    if( np == 4 ) {
+	atom *W0 = W, *W1 = W+L, *W2 = W+2*L, *W3 = W+3*L;
+	// W1 = (r(1)+r(-1))/2 = c0+c2, W2 = (r(1)-r(-1))/2 = c1+c3
+	xbmath::kernel::add_n(pr,W1,W2,L);
+	tc_sar(pr,L,1);
+	xbmath::kernel::sub_n(W2,W1,pr,L);
+	memcpy(W1,pr,L*sizeof(atom));
+	// c2, c1
+	xbmath::kernel::sub_n(W1,W1,W0,L);
+	xbmath::kernel::sub_n(W2,W2,W3,L);
+	c[0] = W0; c[1] = W2; c[2] = W1; c[3] = W3;
+    } else if( np == 5 ) {
+	atom *W0 = W, *W1 = W+L, *W2 = W+2*L, *W3 = W+3*L, *W4 = W+4*L;
+	// W1 = (r(1)+r(-1))/2 = c0+c2+c4, W2 = (r(1)-r(-1))/2 = c1+c3
+	xbmath::kernel::add_n(pr,W1,W2,L);
+	tc_sar(pr,L,1);
+	xbmath::kernel::sub_n(W2,W1,pr,L);
+	memcpy(W1,pr,L*sizeof(atom));
+	// c2
+	xbmath::kernel::sub_n(W1,W1,W0,L);
+	xbmath::kernel::sub_n(W1,W1,W4,L);
+	// c3 = ((r(2) - c0 - 4c2 - 16c4)/2 - (c1+c3)) / 3
+	xbmath::kernel::sub_n(W3,W3,W0,L);
+	xbmath::kernel::submul_1(W3,W1,L,4);
+	xbmath::kernel::submul_1(W3,W4,L,16);
+	tc_sar(W3,L,1);
+	xbmath::kernel::sub_n(W3,W3,W2,L);
+	tc_divexact(W3,L,3);
+	// c1
+	xbmath::kernel::sub_n(W2,W2,W3,L);
+	c[0] = W0; c[1] = W2; c[2] = W1; c[3] = W3; c[4] = W4;
+    } else {
+	atom *W0 = W, *W1 = W+L, *W2 = W+2*L, *W3 = W+3*L,
+	     *W4 = W+4*L, *W5 = W+5*L, *W6 = W+6*L;
+	// W1 = c0+c2+c4+c6, W2 = c1+c3+c5
+	xbmath::kernel::add_n(pr,W1,W2,L);
+	tc_sar(pr,L,1);
+	xbmath::kernel::sub_n(W2,W1,pr,L);
+	memcpy(W1,pr,L*sizeof(atom));
+	// W3 = c0+4c2+16c4+64c6, W4 = c1+4c3+16c5
+	xbmath::kernel::add_n(pr,W3,W4,L);
+	tc_sar(pr,L,1);
+	xbmath::kernel::sub_n(W4,W3,pr,L);
+	tc_sar(W4,L,1);
+	memcpy(W3,pr,L*sizeof(atom));
+	// W1 = c2+c4, W3 = c2+4c4
+	xbmath::kernel::sub_n(W1,W1,W0,L);
+	xbmath::kernel::sub_n(W1,W1,W6,L);
+	xbmath::kernel::sub_n(W3,W3,W0,L);
+	xbmath::kernel::submul_1(W3,W6,L,64);
+	tc_sar(W3,L,2);
+	// c4, c2
+	xbmath::kernel::sub_n(W3,W3,W1,L);
+	tc_divexact(W3,L,3);
+	xbmath::kernel::sub_n(W1,W1,W3,L);
+	// W5 = 16c1+4c3+c5
+	xbmath::kernel::submul_1(W5,W0,L,64);
+	xbmath::kernel::submul_1(W5,W1,L,16);
+	xbmath::kernel::submul_1(W5,W3,L,4);
+	xbmath::kernel::sub_n(W5,W5,W6,L);
+	tc_sar(W5,L,1);
+	// W5 = c1-c5, W4 = c3+5c5, W2 = c3+2c5
+	xbmath::kernel::sub_n(W5,W5,W4,L);
+	tc_divexact(W5,L,15);
+	xbmath::kernel::sub_n(W4,W4,W2,L);
+	tc_divexact(W4,L,3);
+	xbmath::kernel::sub_n(W2,W2,W5,L);
+	// c5, c3, c1
+	xbmath::kernel::sub_n(W4,W4,W2,L);
+	tc_divexact(W4,L,3);
+	xbmath::kernel::submul_1(W2,W4,L,2);
+	xbmath::kernel::add_n(W5,W5,W4,L);
+	c[0] = W0; c[1] = W5; c[2] = W1; c[3] = W2; c[4] = W3; c[5] = W4; c[6] = W6;
+    }
+
+    memset(r,0,(an+bn)*sizeof(atom));
+    for( int i = 0; i < np; ++i )
+	add_at(r,an+bn,i*k,c[i],L);
+}
+
+#ifdef XBM_HAVE_DOUBLE_ATOM
+/*
+    Number theoretic transform multiplication.
+
+    Every atom of the operands is one coefficient. The cyclic
+    convolution is computed modulo three primes p < B/2, 2^k | p-1,
+    and the product coefficients (below N*B^2) are recovered with
+    Garner's CRT and carried into the result.
+*/
+struct ntt_prime {
+    atom p;
+    atom g;	    // primitive root
+    unsigned k;	    // 2^k divides p-1
+};
+
+#if	_XBM_ATOM_LEN == 64
+static const ntt_prime ntt_primes[3] = {
+    { UI64(4179340454199820289), 3, 57 },
+    { UI64(2485986994308513793), 5, 55 },
+    { UI64(1945555039024054273), 5, 56 }
+};
+static const unsigned ntt_max_k = 55;
+#else
+static const ntt_prime ntt_primes[3] = {
+    { 2013265921UL, 31, 27 },
+    { 2113929217UL,  5, 25 },
+    {  469762049UL,  3, 26 }
+};
+static const unsigned ntt_max_k = 25;
+#endif
+
+/* Montgomery arithmetic modulo p < B/2 */
+class ntt_mod {
+public:
+    atom p;
+    atom ninv;	    // -1/p mod B
+    atom r2;	    // B^2 mod p
+
+    ntt_mod(atom _p) : p(_p) {
+	ninv = -binvert(p);
+	xbmath::double_atom r = ((xbmath::double_atom)1 << xbmath::atom_bits) % p;
+	r2 = (atom)(r * r % p);
+    }
+    /* a*b/B mod p */
+    inline atom mul(atom a,atom b) const {
+	xbmath::double_atom t = (xbmath::double_atom)a * b;
+	atom m = (atom)t * ninv;
+	atom x = (atom)((t + (xbmath::double_atom)m * p) >> xbmath::atom_bits);
+	return x >= p ? x - p : x;
+    }
+    inline atom add(atom a,atom b) const {
+	atom s = a + b;
+	return s >= p ? s - p : s;
+    }
+    inline atom sub(atom a,atom b) const {
+	return a >= b ? a - b : a + p - b;
+    }
+    inline atom to_mont(atom a) const {
+	return mul(a,r2);
+    }
+    /* x^e, x and result in Montgomery form */
+    atom pow(atom x,atom e) const {
+	atom r = to_mont(1);
+	while( e ) {
+	    if( e & 1 )
+		r = mul(r,x);
+	    x = mul(x,x);
+	    e >>= 1;
+	}
+	return r;
+    }
+};
+
+/* w[j] = root^j for j < N/2, Montgomery form */
+static void ntt_roots(atom* w,size_type N,const ntt_mod& m,atom root)
+{
+    w[0] = m.to_mont(1);
+    for( size_type j = 1; j < N/2; ++j )
+	w[j] = m.mul(w[j-1],root);
+}
+
+/* decimation in frequency, natural order in, bit reversed out */
+static void ntt_forward(atom* x,size_type N,const ntt_mod& m,const atom* w)
+{
+    for( size_type len = N/2, stride = 1; len >= 1; len /= 2, stride *= 2 )
+	for( size_type i = 0; i < N; i += 2*len )
+	    for( size_type j = 0; j < len; ++j ) {
+		atom u = x[i+j];
+		atom v = x[i+j+len];
+		x[i+j] = m.add(u,v);
+		x[i+j+len] = m.mul(m.sub(u,v),w[j*stride]);
+	    }
+}
+
+/* decimation in time, bit reversed in, natural order out (times N) */
+static void ntt_inverse(atom* x,size_type N,const ntt_mod& m,const atom* w)
+{
+    for( size_type len = 1, stride = N/2; len < N; len *= 2, stride /= 2 )
+	for( size_type i = 0; i < N; i += 2*len )
+	    for( size_type j = 0; j < len; ++j ) {
+		atom u = x[i+j];
+		atom v = m.mul(x[i+j+len],w[j*stride]);
+		x[i+j] = m.add(u,v);
+		x[i+j+len] = m.sub(u,v);
+	    }
+}
+
+/* res = a * b cyclic convolution modulo m, length N */
+static void ntt_convolve(atom* res,const atom* a,size_type an,const atom* b,size_type bn,
+			 size_type N,const ntt_prime& prime,atom* tmp)
+{
+    ntt_mod m(prime.p);
+    atom* w  = tmp;
+    atom* wi = w + N/2;
+    atom* fb = wi + N/2;
+    atom root = m.pow(m.to_mont(prime.g),(prime.p - 1) / N);
+    ntt_roots(w,N,m,root);
+    ntt_roots(wi,N,m,m.pow(root,N-1));
+
+    size_type i;
+    for( i = 0; i < an; ++i )
+	res[i] = a[i] % m.p;
+    for( ; i < N; ++i )
+	res[i] = 0;
+    ntt_forward(res,N,m,w);
+    if( a == b && an == bn )
+	fb = res;
+    else {
+	for( i = 0; i < bn; ++i )
+	    fb[i] = b[i] % m.p;
+	for( ; i < N; ++i )
+	    fb[i] = 0;
+	ntt_forward(fb,N,m,w);
+    }
+
+    // pointwise product gives a*b/B, scale by B^2/N so that
+    // the inverse transform yields the plain convolution
+    atom scale = m.to_mont(m.to_mont(m.p - (m.p - 1) / N));
+    for( i = 0; i < N; ++i )
+	res[i] = m.mul(m.mul(res[i],fb[i]),scale);
+    ntt_inverse(res,N,m,wi);
+}
+
+/* returns false if product is too long for the transform */
+static bool mul_fft(atom* r,const atom* a,size_type an,const atom* b,size_type bn)
+{
+    const size_type rn = an + bn;
+    size_type N = 1;
+    unsigned k = 0;
+    while( N < rn - 1 )
+	N *= 2, ++k;
+    if( k > ntt_max_k )
+	return false;
+
+    tmp_atoms t(5*N);
+    atom* res[3] = { t, (atom*)t + N, (atom*)t + 2*N };
+    for( int j = 0; j < 3; ++j )
+	ntt_convolve(res[j],a,an,b,bn,N,ntt_primes[j],(atom*)t + 3*N);
+
+    // Garner: x = v1 + v2*p1 + v3*p1*p2
+    const atom p1 = ntt_primes[0].p, p2 = ntt_primes[1].p, p3 = ntt_primes[2].p;
+    ntt_mod m2(p2), m3(p3);
+    // constants in Montgomery form: 1/p1 mod p2, 1/(p1*p2) and p1 mod p3
+    atom inv12 = m2.pow(m2.to_mont(p1 % p2),p2 - 2);
+    atom p1_3 = m3.to_mont(p1 % p3);
+    atom inv123 = m3.pow(m3.mul(p1_3,m3.to_mont(p2 % p3)),p3 - 2);
+    atom p12[2];
+    {
+	xbmath::double_atom t12 = (xbmath::double_atom)p1 * p2;
+	p12[0] = (atom)t12;
+	p12[1] = (atom)(t12 >> xbmath::atom_bits);
+    }
+
+    atom acc[4] = { 0, 0, 0, 0 };
+    for( size_type i = 0; i < rn; ++i ) {
+	if( i < rn - 1 ) {
+	    atom v1 = res[0][i];
+	    atom v2 = m2.mul(m2.sub(res[1][i],v1 % p2),inv12);
+	    atom s = m3.add(v1 % p3,m3.mul(v2 % p3,p1_3));
+	    atom v3 = m3.mul(m3.sub(res[2][i],s),inv123);
+	    atom x[3];
+	    x[2] = xbmath::kernel::mul_1(x,p12,2,v3);
+	    atom c = xbmath::kernel::addmul_1(x,&p1,1,v2);
+	    xbmath::kernel::add_1(x+1,x+1,2,c);
+	    xbmath::kernel::add_1(x,x,3,v1);
+	    acc[3] += xbmath::kernel::add_n(acc,acc,x,3);
+	}
+	r[i] = acc[0];
+	acc[0] = acc[1]; acc[1] = acc[2]; acc[2] = acc[3]; acc[3] = 0;
+    }
+    assert( acc[0] == 0 && acc[1] == 0 && acc[2] == 0 );
+    return true;
+}
+#endif
+
+static void mul_blockwise(atom* r,const atom* a,size_type an,const atom* b,size_type bn)
+/*
+    an >= 3*bn: a is cut in chunks of bn atoms, each chunk times b is
+    a balanced product added at its offset.
+*/
+{
+    tmp_atoms t(2*bn);
+    xbmath::kernel::mul(r,a,bn,b,bn);
+    for( size_type off = bn; off < an; off += bn ) {
+	size_type cn = an - off < bn ? an - off : bn;
+	mul_any(t,a+off,cn,b,bn);
+	memcpy(r+off+bn,t+bn,cn*sizeof(atom));
+	atom cf = xbmath::kernel::add_n(r+off,r+off,t,bn);
+	xbmath::kernel::add_1(r+off+bn,r+off+bn,cn,cf);
+    }
+}
+
+void xbmath::kernel::mul(atom* r,const atom* a,size_type an,const atom* b,size_type bn)
+{
+    if( a == b && an == bn ) {
+	sqr(r,a,an);
+    } else if( bn < karatsuba_threshold ) {
+	mul_basecase(r,a,an,b,bn);
+    } else if( an >= 3*bn ) {
+	mul_blockwise(r,a,an,b,bn);
+#ifdef XBM_HAVE_DOUBLE_ATOM
+    } else if( bn >= fft_threshold && mul_fft(r,a,an,b,bn) ) {
+#endif
+    } else if( an >= 2*bn ) {
+	mul_toom(r,a,an,b,bn,4,2);
+    } else if( 2*an >= 3*bn ) {
+	mul_toom(r,a,an,b,bn,3,2);
+    } else if( bn < toom3_threshold ) {
+	mul_karatsuba(r,a,an,b,bn);
+    } else if( bn < toom4_threshold ) {
+	mul_toom(r,a,an,b,bn,3,3);
+    } else {
+	mul_toom(r,a,an,b,bn,4,4);
+    }
+}
+
+atom xbmath::kernel::lshift(atom* r,const atom* a,size_type n,unsigned c)
+{
+    if( n == 0 )
+	return 0;
+    const unsigned rc = atom_bits - c;
+    atom high = a[n-1];
+    atom out = high >> rc;
+    for( size_type i = n-1; i > 0; --i ) {
+	atom low = a[i-1];
+	r[i] = (high << c) | (low >> rc);
+	high = low;
+    }
+    r[0] = high << c;
+    return out;
+}
+
+atom xbmath::kernel::rshift(atom* r,const atom* a,size_type n,unsigned c)
+{
+    if( n == 0 )
+	return 0;
+    const unsigned lc = atom_bits - c;
+    atom low = a[0];
+    atom out = low << lc;
+    for( size_type i = 0; i < n-1; ++i ) {
+	atom high = a[i+1];
+	r[i] = (low >> c) | (high << lc);
+	low = high;
+    }
+    r[n-1] = low >> c;
+    return out;
+}
+
+int xbmath::kernel::cmp(const atom* a,const atom* b,size_type n)
+{
+    while( n > 0 ) {
+	--n;
+	if( a[n] != b[n] )
+	    return a[n] > b[n] ? 1 : -1;
+    }
+    return 0;
+}
+
+void xbmath::kernel::sqr(atom* r,const atom* a,size_type n)
+{
+    if( n < sqr_karatsuba_threshold ) {
+	sqr_basecase(r,a,n);
+#ifdef XBM_HAVE_DOUBLE_ATOM
+    } else if( n >= sqr_fft_threshold && mul_fft(r,a,n,a,n) ) {
+#endif
+    } else if( n < sqr_toom3_threshold ) {
+	sqr_karatsuba(r,a,n);
+    } else if( n < sqr_toom4_threshold ) {
+	mul_toom(r,a,n,a,n,3,3);
+    } else {
+	mul_toom(r,a,n,a,n,4,4);
+    }
+}
+
+static inline atom atom_div_preinv(atom hi,atom lo,atom d,atom v,atom& rem)
+/*
+    Moller, Granlund: Improved division by invariant integers, alg. 4.
+    Requires hi < d, top bit of d set and v = floor((B^2-1)/d) - B;
+    two multiplications instead of a hardware division.
+*/
+{
+    atom q;
+    atom ql = atom_muladd(v,hi,lo,0,q);
+    q += hi + 1;
+    atom r = lo - q * d;
+    // r > ql half of the time, keep it off the branch predictor
+    atom mask = -(atom)(r > ql);
+    q += mask;
+    r += mask & d;
+    if( r >= d ) {
+	++q;
+	r -= d;
+    }
+    rem = r;
+    return q;
+}
+
+xbmath::kernel::inverse_1::inverse_1(atom dd)
+    : d(dd), norm(0), inv(0), shift(0)
+{
+    if( d == 0 )
+	return;
+    shift = atom_clz(d);
+    norm = d << shift;
+    atom r;
+    inv = atom_div(~norm,~(atom)0,norm,r);
+}
+
+atom xbmath::kernel::divrem_1(atom* q,const atom* a,size_type n,const inverse_1& d)
+{
+    const unsigned s = d.shift;
+    atom rem = 0;
+    if( s == 0 ) {
+	for( size_type i = n; i > 0; --i )
+	    q[i-1] = atom_div_preinv(rem,a[i-1],d.norm,d.inv,rem);
+	return rem;
+    }
+    // shift a on the fly, q may be a
+    rem = a[n-1] >> (atom_bits - s);
+    for( size_type i = n-1; i > 0; --i )
+	q[i] = atom_div_preinv(rem,(a[i] << s) | (a[i-1] >> (atom_bits - s)),
+			       d.norm,d.inv,rem);
+    q[0] = atom_div_preinv(rem,a[0] << s,d.norm,d.inv,rem);
+    return rem >> s;
+}
+
+atom xbmath::kernel::mod_1(const atom* a,size_type n,const inverse_1& d)
+{
+    const unsigned s = d.shift;
+    atom rem = 0;
+    if( s == 0 ) {
+	for( size_type i = n; i > 0; --i )
+	    atom_div_preinv(rem,a[i-1],d.norm,d.inv,rem);
+	return rem;
+    }
+    rem = a[n-1] >> (atom_bits - s);
+    for( size_type i = n-1; i > 0; --i )
+	atom_div_preinv(rem,(a[i] << s) | (a[i-1] >> (atom_bits - s)),
+			d.norm,d.inv,rem);
+    atom_div_preinv(rem,a[0] << s,d.norm,d.inv,rem);
+    return rem >> s;
+}
+
+atom xbmath::kernel::divrem_1(atom* q,const atom* a,size_type n,atom d)
+{
+    if( n == 1 ) {
+	atom x = a[0];
+	q[0] = x / d;
+	return x % d;
+    }
+    return divrem_1(q,a,n,inverse_1(d));
+}
+
+static void div_norm(atom* q,atom* u,size_type un,const atom* v,size_type vn)
+/*
+    Knuth, TAOCP vol. 2, 4.3.1, algorithm D, in place.
+    v (vn >= 2 atoms) has its top bit set and the top vn atoms of u are
+    below v. Every quotient atom estimated from the top two atoms of the
+    partial remainder is then at most 2 too large. q gets un-vn atoms,
+    the remainder is left in u[0..vn) and u[vn..un) is cleared.
+*/
+{
+    const atom v1 = v[vn-1], v2 = v[vn-2];
+    const xbmath::kernel::inverse_1 v1inv(v1);
+    for( size_type j = un - vn; j > 0; ) {
+	--j;
+	atom* uj = u + j;
+	atom qhat, rhat;
+	bool rhat_ok = true;
+	if( uj[vn] >= v1 ) {
+	    qhat = ~(atom)0;
+	    rhat = uj[vn-1] + v1;
+	    rhat_ok = rhat >= v1;	// no overflow
+	} else
+	    qhat = atom_div_preinv(uj[vn],uj[vn-1],v1,v1inv.inv,rhat);
+	while( rhat_ok ) {
+	    // qhat * v2 > rhat * B + uj[vn-2] ?
+	    atom hi;
+	    atom lo = atom_muladd(qhat,v2,0,0,hi);
+	    if( hi < rhat || (hi == rhat && lo <= uj[vn-2]) )
+		break;
+	    --qhat;
+	    rhat += v1;
+	    rhat_ok = rhat >= v1;
+	}
+	atom borrow = xbmath::kernel::submul_1(uj,v,vn,qhat);
+	atom top = uj[vn];
+	uj[vn] = top - borrow;
+	if( top < borrow ) {
+	    // qhat was one too large
+	    --qhat;
+	    uj[vn] += xbmath::kernel::add_n(uj,uj,v,vn);
+	}
+	q[j] = qhat;
+    }
+}
+
+static void div_2n_1n(atom* q,atom* a,const atom* d,size_type n);
+
+static void div_3h_2h(atom* q,atom* a,const atom* d,size_type h)
+/*
+    Burnikel-Ziegler: a has 3h atoms, a[h..3h) < d, d has 2h atoms
+    with top bit set. q gets h atoms, remainder is left in a[0..2h).
+    The quotient is estimated from the top 2h atoms of a by the top
+    half of d and corrected at most twice.
+*/
+{
+    const atom* d0 = d;
+    const atom* d1 = d + h;
+    atom* a2 = a + 2*h;
+    int top = 0;
+    if( xbmath::kernel::cmp(a2,d1,h) < 0 ) {
+	div_2n_1n(q,a+h,d1,h);
+    } else {
+	// a2 == d1: q = B^h - 1, remainder a1*B^h + a2 - q*d1 = a1 + d1
+	for( size_type i = 0; i < h; ++i )
+	    q[i] = ~(atom)0;
+	top = (int)xbmath::kernel::add_n(a+h,a+h,d1,h);
+	memset(a2,0,h*sizeof(atom));
+    }
+    tmp_atoms t(2*h);
+    xbmath::kernel::mul(t,q,h,d0,h);
+    top -= (int)xbmath::kernel::sub_n(a,a,t,2*h);
+    while( top < 0 ) {
+	xbmath::kernel::sub_1(q,q,h,1);
+	top += (int)xbmath::kernel::add_n(a,a,d,2*h);
+    }
+}
+
+static void div_2n_1n(atom* q,atom* a,const atom* d,size_type n)
+/*
+    a has 2n atoms, a[n..2n) < d, d has n atoms with top bit set.
+    q gets n atoms, remainder is left in a[0..n), a[n..2n) is cleared.
+*/
+{
+    if( n < xbmath::kernel::div_bz_threshold || (n & 1) ) {
+	div_norm(q,a,2*n,d,n);
+	return;
+    }
+    size_type h = n / 2;
+    div_3h_2h(q+h,a+h,d,h);
+    div_3h_2h(q,a,d,h);
+}
+
+static void divrem_bz(atom* q,atom* r,const atom* a,size_type an,const atom* d,size_type dn)
+/*
+    Divisor is padded with zero atoms to n = j*2^k >= dn atoms,
+    j < div_bz_threshold, so that div_2n_1n halves down to the
+    basecase; the dividend is processed in blocks of n atoms, the
+    top partial block first.
+*/
+{
+    unsigned k = 0;
+    size_type j = dn;
+    while( j >= xbmath::kernel::div_bz_threshold ) {
+	++k;
+	j = (dn + ((size_type)1 << k) - 1) >> k;
+    }
+    const size_type n = j << k;
+    const size_type pad = n - dn;
+    const unsigned s = atom_clz(d[dn-1]);
+    const size_type un = an + pad + 1;
+
+    tmp_atoms t(n + un + 2*n);
+    atom* v = t;
+    atom* u = v + n;		// un atoms and n zero atoms above
+    atom* qt = u + un + n;	// quotient of the top partial block
+    memset(v,0,pad*sizeof(atom));
+    memset(u,0,pad*sizeof(atom));
+    memset(u+un,0,n*sizeof(atom));
+    if( s ) {
+	xbmath::kernel::lshift(v+pad,d,dn,s);
+	u[pad+an] = xbmath::kernel::lshift(u+pad,a,an,s);
+    } else {
+	memcpy(v+pad,d,dn*sizeof(atom));
+	memcpy(u+pad,a,an*sizeof(atom));
+	u[pad+an] = 0;
+    }
+
+    size_type p = un - n;	// quotient atoms
+    size_type m = p % n;
+    if( m ) {
+	p -= m;
+	if( m < xbmath::kernel::div_bz_threshold )
+	    div_norm(q+p,u+p,n+m,v,n);
+	else {
+	    // zero atoms above u make it a full 2n by n block
+	    div_2n_1n(qt,u+p,v,n);
+	    memcpy(q+p,qt,m*sizeof(atom));
+	}
+    }
+    while( p > 0 ) {
+	p -= n;
+	div_2n_1n(q+p,u+p,v,n);
+    }
+    if( s )
+	xbmath::kernel::rshift(r,u+pad,dn,s);
+    else
+	memcpy(r,u+pad,dn*sizeof(atom));
+}
+
+static void invert(atom* V,const atom* D,size_type n)
+/*
+    V = floor((B^2n - 1) / D), D has n atoms with top bit set, V has
+    n+1 atoms. One Newton step from the inverse of the top half:
+	X' = X + X*(B^2n - D*X)/B^2n
+    then corrected to the exact value with the residue B^2n-1 - D*X',
+    which is updated from B^2n - D*X rather than recomputed.
+*/
+{
+    if( n < xbmath::kernel::div_newton_threshold ) {
+	tmp_atoms t(3*n);
+	atom* num = t;
+	atom* rem = num + 2*n;
+	for( size_type i = 0; i < 2*n; ++i )
+	    num[i] = ~(atom)0;
+	xbmath::kernel::divrem(V,rem,num,2*n,D,n);
+	return;
+    }
+    const size_type h = (n + 1) / 2;
+    const size_type l = n - h;
+    const size_type en = 2*n + 1;
+    tmp_atoms t(2*en + 2*n + 3);
+    atom* P = t;
+    atom* E = P + en;
+    atom* M = E + en;		// 2n+3 atoms
+
+    // X = Vh * B^l, Vh the inverse of the top h atoms of D
+    memset(V,0,l*sizeof(atom));
+    invert(V+l,D+l,h);
+    const atom* Vh = V + l;
+
+    // E = B^2n - D*X, two's complement in en atoms
+    memset(P,0,l*sizeof(atom));
+    xbmath::kernel::mul(P+l,D,n,Vh,h+1);
+    memset(E,0,en*sizeof(atom));
+    E[2*n] = 1;
+    const bool neg = xbmath::kernel::sub_n(E,E,P,en) != 0;
+    if( neg )
+	tc_neg(E,en);
+    // X*|E|/B^2n needs only the top of |E|: dropping the low n-1
+    // atoms moves the result by less than one
+    size_type mn = xbmath::kernel::normalize(E+n-1,n+2);
+    size_type dl = 0;		// atoms of the correction, at M+h+1
+    if( mn ) {
+	mul_any(M,Vh,h+1,E+n-1,mn);
+	dl = xbmath::kernel::normalize(M+h+1,mn);
+    }
+    if( neg )
+	tc_neg(E,en);
+    // R = B^2n - 1 - D*X' = E - 1 -+ D*delta, same representation
+    if( dl ) {
+	mul_any(P,M+h+1,dl,D,n);
+	assert( dl + n <= en );
+	if( neg ) {
+	    xbmath::kernel::sub(V,V,n+1,M+h+1,dl);
+	    xbmath::kernel::add(E,E,en,P,dl+n);
+	} else {
+	    xbmath::kernel::add(V,V,n+1,M+h+1,dl);
+	    xbmath::kernel::sub(E,E,en,P,dl+n);
+	}
+    }
+    xbmath::kernel::sub_1(E,E,en,1);
+    while( E[en-1] >> (xbmath::atom_bits-1) ) {
+	xbmath::kernel::sub_1(V,V,n+1,1);
+	xbmath::kernel::add(E,E,en,D,n);
+    }
+    while( xbmath::kernel::normalize(E+n,en-n) || xbmath::kernel::cmp(E,D,n) >= 0 ) {
+	xbmath::kernel::add_1(V,V,n+1,1);
+	xbmath::kernel::sub(E,E,en,D,n);
+    }
+}
+
+static void div_inverse(atom* q,atom* u,size_type k,const atom* v,const atom* V,size_type n)
+/*
+    u has n+k atoms (k <= n), u[k..n+k) < v; V is the inverse of v.
+    q gets k atoms, remainder is left in u[0..n). The estimate
+    floor(u[n..n+k) * V / B^n) is never too large and at most a
+    few units too small.
+*/
+{
+    tmp_atoms t(2*n + 2*k + 1);
+    atom* P = t;		// n+k+1 atoms
+    atom* QD = P + n + k + 1;	// n+k atoms
+    xbmath::kernel::mul(P,V,n+1,u+n,k);
+    assert( P[n+k] == 0 );
+    memcpy(q,P+n,k*sizeof(atom));
+    mul_any(QD,q,k,v,n);
+    xbmath::kernel::sub_n(u,u,QD,n+k);
+    while( xbmath::kernel::normalize(u+n,k) || xbmath::kernel::cmp(u,v,n) >= 0 ) {
+	xbmath::kernel::add_1(q,q,k,1);
+	xbmath::kernel::sub(u,u,n+k,v,n);
+    }
+}
+
+static void divrem_preinv(atom* q,atom* r,const atom* a,size_type an,
+			  const atom* v,const atom* V,size_type dn,unsigned s)
+/*
+    v = d << s has its top bit set, V is its inverse from invert().
+    Every block of dn quotient atoms costs two multiplications.
+*/
+{
+    tmp_atoms u(an + 1);
+    if( s )
+	u[an] = xbmath::kernel::lshift(u,a,an,s);
+    else {
+	memcpy(u,a,an*sizeof(atom));
+	u[an] = 0;
+    }
+    for( size_type p = an + 1 - dn; p > 0; ) {
+	size_type k = p < dn ? p : dn;
+	p -= k;
+	div_inverse(q+p,u+p,k,v,V,dn);
+    }
+    if( s )
+	xbmath::kernel::rshift(r,u,dn,s);
+    else
+	memcpy(r,u,dn*sizeof(atom));
+}
+
+static void divrem_newton(atom* q,atom* r,const atom* a,size_type an,const atom* d,size_type dn)
+{
+    const unsigned s = atom_clz(d[dn-1]);
+    tmp_atoms t(dn + dn + 1);
+    atom* v = t;
+    atom* V = v + dn;
+    if( s )
+	xbmath::kernel::lshift(v,d,dn,s);
+    else
+	memcpy(v,d,dn*sizeof(atom));
+    invert(V,v,dn);
+    divrem_preinv(q,r,a,an,v,V,dn,s);
+}
+
+void xbmath::kernel::divrem(atom* q,atom* r,const atom* a,size_type an,const atom* d,size_type dn)
+{
+    if( dn == 1 ) {
+	r[0] = divrem_1(q,a,an,d[0]);
+	return;
+    }
+    if( dn >= div_bz_threshold && an - dn >= div_bz_threshold ) {
+	// the inverse pays off once it is reused for several blocks
+	if( dn >= div_newton_threshold && an - dn >= 3*dn )
+	    divrem_newton(q,r,a,an,d,dn);
+	else
+	    divrem_bz(q,r,a,an,d,dn);
+	return;
+    }
+    const unsigned s = atom_clz(d[dn-1]);
+    tmp_atoms t(an + 1 + dn);
+    atom* u = t;
+    atom* v = u + an + 1;
+    if( s ) {
+	lshift(v,d,dn,s);
+	u[an] = lshift(u,a,an,s);
+    } else {
+	memcpy(v,d,dn*sizeof(atom));
+	memcpy(u,a,an*sizeof(atom));
+	u[an] = 0;
+    }
+    div_norm(q,u,an+1,v,dn);
+    if( s )
+	rshift(r,u,dn,s);
+    else
+	memcpy(r,u,dn*sizeof(atom));
+}
+
+static void divexact_hensel(atom* q,atom* u,size_type qn,const atom* d,size_type dn,atom dinv)
+/*
+    q = u / d mod B^qn for odd d, working from the low atoms, so no
+    quotient estimates and no corrections are needed. u has qn atoms
+    and is clobbered. Above divexact_threshold the low half of q is
+    found first, its product with d removed and the high half found
+    from what is left, like Burnikel-Ziegler from the other end.
+*/
+{
+    if( qn < xbmath::kernel::divexact_threshold ) {
+	for( size_type i = 0; i < qn; ++i ) {
+	    atom qi = u[i] * dinv;
+	    size_type k = dn < qn - i ? dn : qn - i;
+	    atom borrow = xbmath::kernel::submul_1(u+i,d,k,qi);
+	    if( i + k < qn )
+		xbmath::kernel::sub_1(u+i+k,u+i+k,qn-i-k,borrow);
+	    q[i] = qi;
+	}
+	return;
+    }
+    const size_type h = qn / 2;
+    const size_type k = dn < qn ? dn : qn;
+    divexact_hensel(q,u,h,d,dn,dinv);
+    // low h atoms of u and q*d agree, there is no borrow out of them
+    tmp_atoms t(h + k);
+    mul_any(t,q,h,d,k);
+    xbmath::kernel::sub(u+h,u+h,qn-h,t+h,(h+k < qn ? h+k : qn) - h);
+    divexact_hensel(q+h,u+h,qn-h,d,dn,dinv);
+}
+
+void xbmath::kernel::divexact(atom* q,const atom* a,size_type an,const atom* d,size_type dn)
+{
+    const size_type qn = an - dn + 1;
+    // d divides a, so a has at least the trailing zeros of d
+    while( d[0] == 0 ) {
+	assert( a[0] == 0 );
+	++d; --dn;
+	++a; --an;
+    }
+    if( dn == 1 && d[0] == 1 ) {
+	memcpy(q,a,qn*sizeof(atom));
+	return;
+    }
+    tmp_atoms t(qn + dn + 1);
+    atom* u = t;
+    atom* v = u + qn + 1;
+    size_type cn = an < qn + 1 ? an : qn + 1;
+    memcpy(u,a,cn*sizeof(atom));
+    memset(u+cn,0,(qn+1-cn)*sizeof(atom));
+    const unsigned s = atom_ctz(d[0]);
+    if( s ) {
+	rshift(v,d,dn,s);
+	dn = normalize(v,dn);
+	d = v;
+	rshift(u,u,qn+1,s);
+    }
+    divexact_hensel(q,u,qn,d,dn,binvert(d[0]));
+}
+
+/*
+    Radix conversion, bases 2 to 36. A chunk is the largest power of
+    the base in an atom (10^19 for 64-bit atoms); the divide and
+    conquer splits by powers chunk^(2^i), cached per base between
+    calls. Power of two bases only move bits, in linear time.
+*/
+static const char radix_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+static inline unsigned radix_value(char c)
+/* value of a digit, either case */
+{
+    return c <= '9' ? (unsigned)(c - '0') : (unsigned)((c | 0x20) - 'a' + 10);
+}
+
+static unsigned radix_log2(int base)
+/* k when base is 2^k, otherwise 0 */
+{
+    unsigned k = 0;
+    while( (1 << k) < base )
+	++k;
+    return (1 << k) == base ? k : 0;
+}
+
+static unsigned radix_chunk(int base,atom& big)
+/* big = base^digits, the largest power in an atom; returns digits */
+{
+    const atom top = ~(atom)0 / base;
+    unsigned digits = 0;
+    for( big = 1; big <= top; big *= base )
+	++digits;
+    return digits;
+}
+
+struct radix_power {
+    xbmath::container p;	// chunk^(2^i)
+    size_type zeros;		// low zero atoms of p
+    size_type digits;		// chunk digits * 2^i
+    // above div_newton_threshold: p[zeros..] normalized and its
+    // inverse, made on first use below the top split
+    xbmath::container norm;
+    xbmath::container inv;
+    unsigned shift;
+};
+
+/*
+    The cache is shared by all threads. A power is made under
+    radix_lock and never moves or changes after, so a table taken
+    under the lock stays valid while other threads add powers; only
+    its inverse may come later, also under the lock.
+*/
+#if __cplusplus >= 201103L
+static std::mutex radix_mutex;
+
+class radix_lock {
+    std::lock_guard<std::mutex> g;
+public:
+    radix_lock() : g(radix_mutex) {}
+};
+#elif defined __GNUC__
+static volatile int radix_mutex;
+
+class radix_lock {
+public:
+    radix_lock() {
+	while( __sync_lock_test_and_set(&radix_mutex,1) )
+	    ;
+    }
+    ~radix_lock() { __sync_lock_release(&radix_mutex); }
+};
+#else
+class radix_lock {};	// no threads
+#endif
+
+enum { radix_levels = 64 };	// 2^64 chunks never fit in memory
+
+class radix_table {
+/* the powers of a base made when it was taken */
+public:
+    radix_table(radix_power* const* p,int n) : p(p), n(n) {}
+    int		    size() const { return n; }
+    radix_power&    operator [] (int i) const { return *p[i]; }
+private:
+    radix_power* const* p;
+    int n;
+};
+
+static std::deque<radix_power> radix_cache[37];	// keeps them in place
+static radix_power* radix_index[37][radix_levels];
+
+static radix_table radix_powers(int base,size_type n,size_type digits_n = 0)
+/*
+    powers up to one whose square exceeds any n atom number and
+    has at least digits_n digits
+*/
+{
+    radix_lock lock;
+    std::deque<radix_power>& pw = radix_cache[base];
+    // kept for good, never in the thread's arena
+    xbmath::memory_scope heap(NULL);
+    if( pw.empty() ) {
+	pw.push_back(radix_power());
+	radix_power& d = pw.back();
+	atom big;
+	d.digits = radix_chunk(base,big);
+	d.p.push_back(big);
+	d.zeros = 0;
+	d.shift = 0;
+	radix_index[base][0] = &d;
+    }
+    while( 2*(pw.back().p.size() - 1) < n || 2*pw.back().digits < digits_n ) {
+	assert( pw.size() < radix_levels );
+	const radix_power& l = pw.back();
+	pw.push_back(radix_power());
+	radix_power& d = pw.back();
+	size_type ln = l.p.size();
+	d.p.resize(2*ln);
+	xbmath::kernel::sqr(&d.p[0],&l.p[0],ln);
+	d.p.resize(xbmath::kernel::normalize(&d.p[0],2*ln));
+	d.zeros = 0;
+	while( d.p[d.zeros] == 0 )
+	    ++d.zeros;
+	d.digits = 2*l.digits;
+	d.shift = 0;
+	radix_index[base][pw.size()-1] = &d;
+    }
+    return radix_table(radix_index[base],(int)pw.size());
+}
+
+static const char dec_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+class radix_out {
+/*
+    Where digits go: straight into a string, or through a small
+    buffer to a kernel::str_writer, most significant first.
+*/
+public:
+    radix_out(char* s) : s(s), b(s), e(0), w(0), n(0) {}
+    radix_out(char* buf,size_type len,xbmath::kernel::str_writer& w)
+	: s(buf), b(buf), e(buf + len), w(&w), n(0) {}
+
+    enum { room_max = 64 };	// digits of an atom in base 2
+
+    char* room(size_type len)
+    /* space for len <= room_max characters, filled up to done() */
+    {
+	if( w && s + len > e )
+	    flush();
+	return s;
+    }
+    void done(char* t) { s = t; }
+    void zeros(size_type len)
+    {
+	while( len > 0 ) {
+	    size_type k = len < room_max ? len : room_max;
+	    memset(room(k),'0',k);
+	    s += k;
+	    len -= k;
+	}
+    }
+    size_type count()
+    /* characters written so far */
+    {
+	flush();
+	return n + (s - b);
+    }
+private:
+    void flush()
+    {
+	if( w && s > b ) {
+	    w->write(b,s - b);
+	    n += s - b;
+	    s = b;
+	}
+    }
+    char* s;
+    char* b;
+    char* e;
+    xbmath::kernel::str_writer* w;
+    size_type n;
+};
+
+static void put_digits(radix_out& o,atom x,size_type width,int base)
+/*
+    x as exactly width digits, zero padded, width 0 means minimal;
+    decimal takes two digits per division, from the right.
+*/
+{
+    if( width == 0 || width > radix_out::room_max ) {
+	size_type m = 1;
+	for( atom p = base; x >= p; p *= base ) {
+	    ++m;
+	    if( p > ~(atom)0 / base )
+		break;
+	}
+	assert( width == 0 || width >= m );
+	if( width > m )
+	    o.zeros(width - m);
+	width = m;
+    }
+    char* s = o.room(width);
+    char* b = s + width;
+    if( base == 10 ) {
+	while( x >= 100 ) {
+	    unsigned r = (unsigned)(x % 100);
+	    x /= 100;
+	    b -= 2;
+	    memcpy(b,dec_pairs + 2*r,2);
+	}
+	if( x >= 10 ) {
+	    b -= 2;
+	    memcpy(b,dec_pairs + 2*x,2);
+	} else if( x > 0 || b == s + width )
+	    *--b = (char)('0' + x);
+    } else {
+	do {
+	    *--b = radix_digits[x % base];
+	    x /= base;
+	} while( x > 0 );
+    }
+    while( b > s )
+	*--b = '0';
+    o.done(s + width);
+}
+
+static void to_str_basecase(radix_out& o,atom* a,size_type n,size_type width,int base)
+/* chunks by repeated division by the chunk, a is clobbered */
+{
+    atom big;
+    const unsigned digits = radix_chunk(base,big);
+    const xbmath::kernel::inverse_1 inv(big);
+    // big >= 2^k, so a < 2^(n*atom_bits) has at most that / k chunks
+    const size_type k = xbmath::atom_bits - 1 - atom_clz(big);
+    tmp_atoms c((n*xbmath::atom_bits + k - 1) / k);
+    size_type cn = 0;
+    while( n > 0 ) {
+	c[cn++] = xbmath::kernel::divrem_1(a,a,n,inv);
+	n = xbmath::kernel::normalize(a,n);
+    }
+    if( cn == 0 ) {
+	put_digits(o,0,width,base);
+	return;
+    }
+    size_type rest = (cn-1) * digits;
+    assert( width == 0 || width >= rest );
+    put_digits(o,c[cn-1],width ? width - rest : 0,base);
+    for( size_type i = cn-1; i > 0; --i )
+	put_digits(o,c[i-1],digits,base);
+}
+
+static void radix_invert(radix_power& P)
+/* P.norm and P.inv, made once under the lock */
+{
+    radix_lock lock;
+    if( !P.inv.empty() )
+	return;
+    xbmath::memory_scope heap(NULL);	// cached, as in radix_powers
+    const size_type pn = P.p.size();
+    const size_type z = P.zeros;
+    const size_type dn = pn - z;
+    P.shift = atom_clz(P.p[pn-1]);
+    P.norm.resize(dn);
+    if( P.shift )
+	xbmath::kernel::lshift(&P.norm[0],&P.p[z],dn,P.shift);
+    else
+	memcpy(&P.norm[0],&P.p[z],dn*sizeof(atom));
+    P.inv.resize(dn+1);
+    invert(&P.inv[0],&P.norm[0],dn);
+}
+
+static void to_str_dc(radix_out& o,atom* a,size_type n,size_type width,int base,
+		      int level,const radix_table& pw,bool top)
+/*
+    a = hi * P + lo with P = pw[level]; hi is written first, lo
+    padded to the digits of P. a is clobbered. Every power below
+    the top split divides several numbers, so large ones keep
+    their Newton inverse.
+*/
+{
+    n = xbmath::kernel::normalize(a,n);
+    if( level < 0 || n < xbmath::kernel::str_dc_threshold ) {
+	to_str_basecase(o,a,n,width,base);
+	return;
+    }
+    const radix_power& P = pw[level];
+    const size_type pn = P.p.size();
+    const size_type z = P.zeros;
+    if( n < pn || (n == pn && xbmath::kernel::cmp(a,&P.p[0],n) < 0) ) {
+	to_str_dc(o,a,n,width,base,level-1,pw,top);
+	return;
+    }
+    // low zero atoms of P only carry the low atoms of a into lo
+    const size_type qn = n - pn + 1;
+    const size_type dn = pn - z;
+    tmp_atoms t(qn + dn);
+    atom* q = t;
+    atom* r = q + qn;
+    if( !top && dn >= xbmath::kernel::div_newton_threshold ) {
+	radix_invert(pw[level]);
+	divrem_preinv(q,r,a+z,n-z,&P.norm[0],&P.inv[0],dn,P.shift);
+    } else
+	xbmath::kernel::divrem(q,r,a+z,n-z,&P.p[z],dn);
+    memcpy(a+z,r,dn*sizeof(atom));
+    to_str_dc(o,q,qn,width ? width - P.digits : 0,base,level-1,pw,false);
+    to_str_dc(o,a,pn,P.digits,base,level-1,pw,false);
+}
+
+static void to_str_pow2(radix_out& o,const atom* a,size_type n,size_type width,unsigned k)
+/* k bits a digit from the top; a digit may straddle two atoms */
+{
+    size_type len = (xbmath::kernel::bit_length(a,n) + k - 1) / k;
+    if( len == 0 ) {
+	put_digits(o,0,width,1 << k);
+	return;
+    }
+    assert( width == 0 || width >= len );
+    if( width > len )
+	o.zeros(width - len);
+    const atom mask = ((atom)1 << k) - 1;
+    size_type pos = (len - 1) * k;
+    while( len > 0 ) {
+	const size_type m = len < radix_out::room_max ? len : radix_out::room_max;
+	char* s = o.room(m);
+	for( size_type j = 0; j < m; ++j, pos -= k ) {
+	    const size_type i = pos / xbmath::atom_bits;
+	    const unsigned off = pos % xbmath::atom_bits;
+	    atom x = a[i] >> off;
+	    if( off + k > xbmath::atom_bits && i + 1 < n )
+		x |= a[i+1] << (xbmath::atom_bits - off);
+	    s[j] = radix_digits[x & mask];
+	}
+	o.done(s + m);
+	len -= m;
+    }
+}
+
+static void to_str_any(radix_out& o,const atom* a,size_type n,size_type width,int base)
+{
+    assert( base >= 2 && base <= 36 );
+    if( unsigned k = radix_log2(base) ) {
+	to_str_pow2(o,a,n,width,k);
+	return;
+    }
+    n = xbmath::kernel::normalize(a,n);
+    if( n <= 1 ) {
+	put_digits(o,n ? a[0] : 0,width,base);
+	return;
+    }
+    tmp_atoms u(n);
+    memcpy(u,a,n*sizeof(atom));
+    if( n < xbmath::kernel::str_dc_threshold )
+	to_str_basecase(o,u,n,width,base);
+    else {
+	radix_table pw = radix_powers(base,n);
+	to_str_dc(o,u,n,width,base,pw.size()-1,pw,true);
+    }
+}
+
+xbmath::kernel::size_type xbmath::kernel::to_str(char* s,const atom* a,size_type n,int base)
+{
+    radix_out o(s);
+    to_str_any(o,a,n,0,base);
+    return o.count();
+}
+
+xbmath::kernel::size_type xbmath::kernel::to_str(str_writer& w,const atom* a,size_type n,
+						  int base,size_type width)
+{
+    char buf[1024];
+    radix_out o(buf,sizeof buf,w);
+    to_str_any(o,a,n,width,base);
+    return o.count();
+}
+
+xbmath::kernel::size_type xbmath::kernel::bit_length(const atom* a,size_type n)
+{
+    n = normalize(a,n);
+    return n ? n*atom_bits - atom_clz(a[n-1]) : 0;
+}
+
+xbmath::kernel::size_type xbmath::kernel::str_digits_max(const atom* a,size_type n,int base)
+{
+    assert( base >= 2 && base <= 36 );
+    const size_type bits = bit_length(a,n);
+    if( unsigned k = radix_log2(base) )
+	return bits ? (bits + k - 1) / k : 1;
+    // floor(bits * log(2)/log(base)) + 1, rounded up when near an integer
+    double x = (double)bits * (log(2.0) / log((double)base));
+    return (size_type)(x + x * 1e-14 + 1e-9) + 1;
+}
+
+static size_type from_str_basecase(atom* r,const char* s,size_type len,int base)
+/* chunks of chunk digits by multiply and add */
+{
+    atom big;
+    const unsigned digits = radix_chunk(base,big);
+    size_type n = 0;
+    size_type k = len % digits ? len % digits : digits;
+    while( len > 0 ) {
+	atom c = 0;
+	for( size_type i = 0; i < k; ++i )
+	    c = c * base + radix_value(s[i]);
+	s += k;
+	len -= k;
+	k = digits;
+	atom cf = n ? xbmath::kernel::mul_1(r,r,n,big) : 0;
+	if( n )
+	    cf += xbmath::kernel::add_1(r,r,n,c);
+	else
+	    cf = c;
+	if( cf )
+	    r[n++] = cf;
+    }
+    return n;
+}
+
+static size_type from_str_dc(atom* r,const char* s,size_type len,int base,
+			     unsigned digits,int level,
+			     const radix_table& pw)
+/*
+    Digits split so that the low part has the digits of P =
+    pw[level], r = hi * P + lo. Returns the atoms of r.
+*/
+{
+    if( level < 0 || len < xbmath::kernel::str_dc_threshold * digits )
+	return from_str_basecase(r,s,len,base);
+    const radix_power& P = pw[level];
+    const size_type L = P.digits;
+    if( len <= L )
+	return from_str_dc(r,s,len,base,digits,level-1,pw);
+    tmp_atoms t((len - L)/digits + 1 + L/digits + 1);
+    atom* hi = t;
+    atom* lo = hi + (len - L)/digits + 1;
+    size_type hn = from_str_dc(hi,s,len-L,base,digits,level-1,pw);
+    size_type ln = from_str_dc(lo,s+len-L,L,base,digits,level-1,pw);
+    if( hn == 0 ) {
+	memcpy(r,lo,ln*sizeof(atom));
+	return ln;
+    }
+    // low zero atoms of P only shift the product
+    const size_type pn = P.p.size();
+    const size_type z = P.zeros;
+    memset(r,0,z*sizeof(atom));
+    mul_any(r+z,hi,hn,&P.p[z],pn-z);
+    size_type rn = hn + pn;
+    if( ln )
+	xbmath::kernel::add(r,r,rn,lo,ln);
+    return xbmath::kernel::normalize(r,rn);
+}
+
+static size_type from_str_pow2(atom* r,const char* s,size_type len,unsigned k)
+/* k bits a digit from the low end; a digit may straddle two atoms */
+{
+    const size_type rn = (len*k + xbmath::atom_bits - 1) / xbmath::atom_bits;
+    memset(r,0,rn*sizeof(atom));
+    size_type i = 0;
+    unsigned off = 0;
+    for( const char* e = s + len; e > s; ) {
+	atom d = radix_value(*--e);
+	r[i] |= d << off;
+	if( off + k > xbmath::atom_bits )
+	    r[i+1] |= d >> (xbmath::atom_bits - off);
+	off += k;
+	if( off >= xbmath::atom_bits ) {
+	    off -= xbmath::atom_bits;
+	    ++i;
+	}
+    }
+    return xbmath::kernel::normalize(r,rn);
+}
+
+xbmath::kernel::size_type xbmath::kernel::str_atoms_max(size_type len,int base)
+{
+    if( unsigned k = radix_log2(base) )
+	return len*k / atom_bits + 1;
+    atom big;
+    const unsigned digits = radix_chunk(base,big);
+    return len / digits + 1;
+}
+
+xbmath::kernel::size_type xbmath::kernel::from_str(atom* r,const char* s,size_type len,int base)
+{
+    assert( base >= 2 && base <= 36 );
+    if( unsigned k = radix_log2(base) )
+	return from_str_pow2(r,s,len,k);
+    atom big;
+    const unsigned digits = radix_chunk(base,big);
+    if( len < str_dc_threshold * digits )
+	return from_str_basecase(r,s,len,base);
+    radix_table pw = radix_powers(base,0,len);
+    return from_str_dc(r,s,len,base,digits,pw.size()-1,pw);
+}
+
+static void radix_power_of(xbmath::container& r,int base,size_type m)
+/* r = base^m, a product of cached powers */
+{
+    atom big;
+    const unsigned digits = radix_chunk(base,big);
+    atom t = 1;
+    for( size_type i = m % digits; i > 0; --i )
+	t *= base;
+    r.assign(1,t);
+    size_type c = m / digits;
+    if( c == 0 )
+	return;
+    unsigned top = 0;
+    while( c >> (top+1) )
+	++top;
+    radix_table pw = radix_powers(base,0,(size_type)digits << (top+1));
+    for( unsigned i = 0; c; ++i, c >>= 1 ) {
+	if( !(c & 1) )
+	    continue;
+	const xbmath::container& P = pw[i].p;
+	xbmath::container x(r.size() + P.size());
+	mul_any(&x[0],&r[0],r.size(),&P[0],P.size());
+	x.resize(xbmath::kernel::normalize(&x[0],x.size()));
+	r.swap(x);
+    }
+}
+
+static void radix_shift_add(xbmath::container& a,const xbmath::container& b,
+			    size_type d,int base)
+/* a = a * base^d + b, b has at most d digits; empty means zero */
+{
+    const size_type an = xbmath::kernel::normalize(a.empty() ? NULL : &a[0],a.size());
+    const size_type bn = xbmath::kernel::normalize(b.empty() ? NULL : &b[0],b.size());
+    if( an == 0 ) {
+	a.assign(b.begin(),b.begin() + bn);
+	return;
+    }
+    xbmath::container r;
+    if( unsigned k = radix_log2(base) ) {
+	const size_type w = d*k / xbmath::atom_bits;
+	const unsigned sh = d*k % xbmath::atom_bits;
+	r.assign(an + w + 1,0);
+	if( sh )
+	    r[an+w] = xbmath::kernel::lshift(&r[w],&a[0],an,sh);
+	else
+	    memcpy(&r[w],&a[0],an*sizeof(atom));
+    } else {
+	// block sizes are cached powers, only the last piece is not
+	atom big;
+	const unsigned digits = radix_chunk(base,big);
+	unsigned i = 0;
+	while( ((size_type)digits << i) < d )
+	    ++i;
+	const xbmath::container* P;
+	size_type z = 0;
+	xbmath::container t;
+	if( ((size_type)digits << i) == d ) {
+	    const radix_power& pi = radix_powers(base,0,2*d)[i];
+	    P = &pi.p;
+	    z = pi.zeros;
+	} else {
+	    radix_power_of(t,base,d);
+	    P = &t;
+	}
+	const size_type pn = P->size();
+	r.assign(an + pn,0);
+	mul_any(&r[z],&a[0],an,&(*P)[z],pn-z);
+    }
+    if( bn )
+	xbmath::kernel::add(&r[0],&r[0],r.size(),&b[0],bn);
+    r.resize(xbmath::kernel::normalize(&r[0],r.size()));
+    a.swap(r);
+}
+
+xbmath::kernel::str_reader::str_reader(int base)
+    : base(base), fill(0), count(0)
+{
+    assert( base >= 2 && base <= 36 );
+    // a cached power of the base, so full blocks merge cheaply
+    atom big;
+    block.resize(radix_log2(base) ? 4096 : (size_type)radix_chunk(base,big) << 8);
+}
+
+void xbmath::kernel::str_reader::put(const char* s,size_type len)
+{
+    count += len;
+    while( len > 0 ) {
+	size_type k = block.size() - fill;
+	if( k > len )
+	    k = len;
+	memcpy(&block[fill],s,k);
+	fill += k;
+	s += k;
+	len -= k;
+	if( fill == block.size() )
+	    flush();
+    }
+}
+
+void xbmath::kernel::str_reader::flush()
+/* converts the block and merges equal sizes, like a binary counter */
+{
+    container v(str_atoms_max(fill,base));
+    v.resize(from_str(&v[0],&block[0],fill,base));
+    values.push_back(container());
+    values.back().swap(v);
+    sizes.push_back(fill);
+    fill = 0;
+    for( size_type n = sizes.size(); n >= 2 && sizes[n-1] == sizes[n-2]; --n ) {
+	radix_shift_add(values[n-2],values[n-1],sizes[n-1],base);
+	sizes[n-2] += sizes[n-1];
+	values.pop_back();
+	sizes.pop_back();
+    }
+}
+
+void xbmath::kernel::str_reader::get(container& r)
+{
+    if( fill )
+	flush();
+    r.clear();
+    for( size_type i = 0; i < values.size(); ++i )
+	radix_shift_add(r,values[i],sizes[i],base);
+    if( r.empty() )
+	r.push_back(0);
+    values.clear();
+    sizes.clear();
+    count = 0;
+}
+
+/*
+    Digit counts and leading digits without a conversion. A number or
+    a power of the base is bracketed by bounds m * B^e that keep only
+    the top k atoms of m, rounded down for the lower and up for the
+    upper bound; powers come from squaring the bounds, in constant
+    size. The brackets decide unless the value lies within a unit of
+    the last kept atom of the answer (an exact power of the base, say);
+    only then the full power is made.
+*/
+struct radix_bound {
+    xbmath::container m;	// normalized, empty for zero
+    size_type e;		// atoms below m
+};
+
+static void bound_round(radix_bound& x,size_type k,bool up)
+/* keeps the top k atoms of m, rounded */
+{
+    const size_type n = xbmath::kernel::normalize(x.m.empty() ? NULL : &x.m[0],x.m.size());
+    x.m.resize(n);
+    if( n <= k )
+	return;
+    const size_type d = n - k;
+    const bool inexact = up && xbmath::kernel::normalize(&x.m[0],d) != 0;
+    x.m.erase(x.m.begin(),x.m.begin() + d);
+    x.e += d;
+    if( inexact && xbmath::kernel::add_1(&x.m[0],&x.m[0],k,1) )
+	x.m.push_back(1);
+}
+
+static void bound_of(radix_bound& x,const atom* a,size_type n,size_type k,bool up)
+{
+    x.m.assign(a,a + n);
+    x.e = 0;
+    bound_round(x,k,up);
+}
+
+static void bound_mul(radix_bound& x,const radix_bound& a,const radix_bound& b,
+		      size_type k,bool up)
+{
+    xbmath::container r(a.m.size() + b.m.size());
+    mul_any(&r[0],&a.m[0],a.m.size(),&b.m[0],b.m.size());
+    x.m.swap(r);
+    x.e = a.e + b.e;
+    bound_round(x,k,up);
+}
+
+static void bound_pow(radix_bound& lo,radix_bound& hi,int base,size_type m,size_type k)
+/* lo <= base^m <= hi: chunk^(m / digits) from the top bit, then the rest */
+{
+    atom big;
+    const unsigned digits = radix_chunk(base,big);
+    radix_bound b;
+    b.m.assign(1,big);
+    b.e = 0;
+    lo.m.assign(1,1);
+    lo.e = 0;
+    hi = lo;
+    const size_type c = m / digits;
+    int top = -1;
+    while( c >> (top+1) )
+	++top;
+    for( int i = top; i >= 0; --i ) {
+	bound_mul(lo,lo,lo,k,false);
+	bound_mul(hi,hi,hi,k,true);
+	if( (c >> i) & 1 ) {
+	    bound_mul(lo,lo,b,k,false);
+	    bound_mul(hi,hi,b,k,true);
+	}
+    }
+    b.m[0] = 1;
+    for( size_type i = m % digits; i > 0; --i )
+	b.m[0] *= base;
+    bound_mul(lo,lo,b,k,false);
+    bound_mul(hi,hi,b,k,true);
+}
+
+static int bound_cmp(const radix_bound& a,const radix_bound& b)
+{
+    const size_type an = a.m.size();
+    const size_type bn = b.m.size();
+    if( an + a.e != bn + b.e )
+	return an + a.e < bn + b.e ? -1 : 1;
+    for( size_type i = 1; i <= an || i <= bn; ++i ) {
+	const atom x = i <= an ? a.m[an-i] : 0;
+	const atom y = i <= bn ? b.m[bn-i] : 0;
+	if( x != y )
+	    return x < y ? -1 : 1;
+    }
+    return 0;
+}
+
+static void bound_div(xbmath::container& q,const radix_bound& a,const radix_bound& b)
+/* q = floor(a / b), normalized */
+{
+    xbmath::container u(a.m);
+    xbmath::container v(b.m);
+    if( a.e > b.e )
+	u.insert(u.begin(),a.e - b.e,0);
+    else
+	v.insert(v.begin(),b.e - a.e,0);
+    const size_type un = u.size();
+    const size_type vn = v.size();
+    if( un < vn ) {
+	q.clear();
+	return;
+    }
+    q.resize(un - vn + 1);
+    tmp_atoms r(vn);
+    xbmath::kernel::divrem(&q[0],r,&u[0],un,&v[0],vn);
+    q.resize(xbmath::kernel::normalize(&q[0],q.size()));
+}
+
+static int radix_cmp(const atom* a,size_type n,const xbmath::container& b)
+/* a, normalized, against b */
+{
+    const size_type bn = xbmath::kernel::normalize(&b[0],b.size());
+    if( n != bn )
+	return n < bn ? -1 : 1;
+    return n ? xbmath::kernel::cmp(a,&b[0],n) : 0;
+}
+
+xbmath::kernel::size_type xbmath::kernel::str_digits(const atom* a,size_type n,int base)
+{
+    assert( base >= 2 && base <= 36 );
+    n = normalize(a,n);
+    const size_type d = str_digits_max(a,n,base);
+    if( d <= 1 || radix_log2(base) )
+	return d;
+    // d is exact unless a < base^(d-1)
+    const size_type m = d - 1;
+    radix_bound xl,xh,pl,ph;
+    bound_of(xl,a,n,3,false);
+    bound_of(xh,a,n,3,true);
+    bound_pow(pl,ph,base,m,3);
+    if( bound_cmp(xh,pl) < 0 )
+	return m;
+    if( bound_cmp(xl,ph) >= 0 )
+	return d;
+    xbmath::container p;
+    radix_power_of(p,base,m);
+    return radix_cmp(a,n,p) < 0 ? m : d;
+}
+
+xbmath::kernel::size_type xbmath::kernel::str_leading(char* s,const atom* a,size_type n,
+						      size_type len,int base)
+{
+    assert( base >= 2 && base <= 36 );
+    if( len == 0 )
+	return 0;
+    n = normalize(a,n);
+    const size_type d = str_digits(a,n,base);
+    if( d <= len )
+	return to_str(s,a,n,base);
+    // the quotient by base^(d-len) has exactly len digits
+    const size_type m = d - len;
+    container q;
+    if( unsigned k = radix_log2(base) ) {
+	const size_type sh = m*k;
+	q.assign(a + sh / atom_bits,a + n);
+	if( sh % atom_bits )
+	    rshift(&q[0],&q[0],q.size(),sh % atom_bits);
+    } else {
+	atom big;
+	const size_type top = len / radix_chunk(base,big) + 3;
+	radix_bound xl,xh,pl,ph;
+	bound_of(xl,a,n,top,false);
+	bound_of(xh,a,n,top,true);
+	bound_pow(pl,ph,base,m,top);
+	container qh;
+	bound_div(q,xl,ph);
+	bound_div(qh,xh,pl);
+	if( q.size() != qh.size() || cmp(&q[0],&qh[0],q.size()) != 0 ) {
+	    // few candidates, the largest with q * base^m <= a
+	    container p;
+	    radix_power_of(p,base,m);
+	    const size_type pn = p.size();
+	    container t(pn + qh.size());
+	    for( ;; ) {
+		mul_any(&t[0],&p[0],pn,&qh[0],qh.size());
+		if( radix_cmp(a,n,t) >= 0 )
+		    break;
+		sub_1(&qh[0],&qh[0],qh.size(),1);
+	    }
+	    q.swap(qh);
+	}
+    }
+    return to_str(s,&q[0],q.size(),base);
+}
+
+xbmath::kernel::size_type xbmath::kernel::str_trailing(char* s,const atom* a,size_type n,
+						       size_type len,int base)
+{
+    assert( base >= 2 && base <= 36 );
+    if( len == 0 )
+	return 0;
+    n = normalize(a,n);
+    // a mod base^len, zero padded unless a is that short
+    container r;
+    if( unsigned k = radix_log2(base) ) {
+	const size_type bits = len*k;
+	if( bit_length(a,n) <= bits )
+	    return to_str(s,a,n,base);
+	r.assign(a,a + (bits + atom_bits - 1) / atom_bits);
+	if( bits % atom_bits )
+	    r.back() &= ((atom)1 << (bits % atom_bits)) - 1;
+    } else {
+	container p;
+	radix_power_of(p,base,len);
+	if( radix_cmp(a,n,p) < 0 )
+	    return to_str(s,a,n,base);
+	const size_type pn = p.size();
+	r.resize(pn);
+	tmp_atoms q(n - pn + 1);
+	divrem(q,&r[0],a,n,&p[0],pn);
+    }
+    radix_out o(s);
+    to_str_any(o,&r[0],r.size(),len,base);
+    return o.count();
+}
+
+double xbmath::kernel::log2(const atom* a,size_type n)
+{
+    n = normalize(a,n);
+    if( n == 0 )
+	return -HUGE_VAL;
+    // the top atom's worth of bits, below it only the exponent counts
+    const unsigned s = atom_clz(a[n-1]);
+    atom t = a[n-1] << s;
+    if( s && n > 1 )
+	t |= a[n-2] >> (atom_bits - s);
+    return log((double)t) / log(2.0) + (double)(n*atom_bits - s) - (double)atom_bits;
+}
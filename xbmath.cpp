@@ -49,293 +49,1219 @@ USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "xbmath.h"
 #ifdef _MSC_VER
 #pragma warning (disable: 4786) // long identifiers when creating debug info
+#include <io.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define XBM_HAVE_MMAP
+#endif
+#include <new>
+#include <time.h>
+#if __cplusplus >= 201103L
+#include <atomic>
 #endif
 
-xbmath::natural& xbmath::natural::set (const char* s)
+#ifdef XBM_WITH_EXCEPTIONS
+xbmath::exception::exception(string s) : msg(s), exc_code(exc_unknown)
 {
-    if( s ) {
-	zero();
-	if( *s ) {
-	    if( isdigit(*s) )
-		add( (atom)((*s) - '0') );
-	    s++;
-	}
-	while( *s ) {
-	    if( isdigit(*s) ) {
-		mul10();
-		add( (atom)((*s) - '0') );
+}
+
+xbmath::exception::exception(exc_code_e ecode) : exc_code(ecode)
+{
+    switch( ecode ) {
+    case exc_division_by_zero:
+	msg = "division by zero";
+	break;
+    case exc_invalid_base:
+	msg = "invalid base";
+	break;
+    case exc_checkpoint:
+	msg = "checkpoint not saved";
+	break;
+    default:
+	msg = "unknown error";
+    }
+}
+
+const char* xbmath::exception::get_str() const
+{
+    return msg.c_str();
+}
+#endif
+
+static inline int digit_value(int c)
+/* value of a digit in bases up to 36, either case, else 36 */
+{
+    if( c >= '0' && c <= '9' )
+	return c - '0';
+    c |= 0x20;
+    return c >= 'a' && c <= 'z' ? c - 'a' + 10 : 36;
+}
+
+static xbmath::kernel::size_type keep_digits(char* s,xbmath::kernel::size_type len,int base)
+/* drops characters that are not digits of base, returns the rest */
+{
+    xbmath::kernel::size_type n = 0;
+    for( xbmath::kernel::size_type i = 0; i < len; ++i )
+	if( digit_value((unsigned char)s[i]) < base )
+	    s[n++] = s[i];
+    return n;
+}
+
+typedef long (*read_fn)(void* src,char* buf,size_t len);
+
+static bool read_number(read_fn f,void* src,int base,xbmath::container& p,bool* sign)
+/*
+    Digits of base from a source until its end, converted a block
+    at a time; other characters are skipped as by set_str. With
+    sign, a '-' before the first digit makes it false. False on a
+    read error, p then holds the digits read so far.
+*/
+{
+    xbmath::kernel::str_reader r(base);
+    std::vector<char> buf(1 << 16);
+    bool first = sign != NULL;
+    long len;
+    while( (len = f(src,&buf[0],buf.size())) > 0 ) {
+	char* s = &buf[0];
+	if( first ) {
+	    while( len > 0 && isspace((unsigned char)*s) )
+		++s, --len;
+	    if( len > 0 ) {
+		first = false;
+		*sign = *s != '-';
 	    }
-	    s++;
 	}
-    } else
-	p.insert(p.begin(),0);
+	r.put(s,keep_digits(s,len,base));
+    }
+    r.get(p);
+    return len == 0;
+}
+
+static long read_file(void* src,char* buf,size_t len)
+{
+    size_t n = fread(buf,1,len,(FILE*)src);
+    return n > 0 ? (long)n : ferror((FILE*)src) ? -1 : 0;
+}
+
+static long read_fd(void* src,char* buf,size_t len)
+{
+    return (long)::read(*(int*)src,buf,len);
+}
+
+xbmath::natural& xbmath::natural::set_str(const char* s,int base)
+{
+    if( base < 2 || base > 36 ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_invalid_base);
+#else
+	assert( base >= 2 && base <= 36 );
+	return zero();
+#endif
+    }
+    if( s == NULL )
+	return zero();
+    // characters other than digits of the base are skipped
+    std::vector<char> d(s,s + strlen(s));
+    if( !d.empty() )
+	d.resize(keep_digits(&d[0],d.size(),base));
+    if( d.empty() )
+	return zero();
+    container r(kernel::str_atoms_max(d.size(),base));
+    kernel::size_type n = kernel::from_str(&r[0],&d[0],d.size(),base);
+    if( n == 0 )
+	r[n++] = 0;
+    r.resize(n);
+    p.swap(r);
     return *this;
 }
 
-void	xbmath::natural::str_dec(char* buf,int max) const
+void	xbmath::natural::to_str(char* buf,int max,int base) const
 {
-    //16 bits: 65535
-    //32 bits: 4294967295
-    //64 bits: 18446744073709551615
-    switch( p.size() ) {
-    case 0:
-	strcpy(buf,"0");
+    if( base < 2 || base > 36 ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_invalid_base);
+#else
+	assert( base >= 2 && base <= 36 );
 	return;
-    case 1:
-	sprintf(buf,XBM_ATOM_FMT_DEC,*(p.begin()));
+#endif
+    }
+    if( buf == NULL || max <= 0 )
+	return;
+    if( p.size() == 0 ) {
+	if( max > 1 )
+	    *buf++ = '0';
+	*buf = '\0';
 	return;
     }
+    kernel::size_type len;
+    if( max > str_length(base) )
+	len = kernel::to_str(buf,&p[0],p.size(),base);
+    else {
+	// truncated output
+	std::vector<char> t(str_length(base));
+	len = kernel::to_str(&t[0],&p[0],p.size(),base);
+	if( len > (kernel::size_type)(max - 1) )
+	    len = max - 1;
+	memcpy(buf,&t[0],len);
+    }
+    buf[len] = '\0';
+}
 
-    enum {
-#if	_XBM_ATOM_LEN == 16
-	atom_base =  10000
-#elif	_XBM_ATOM_LEN == 32
-	    atom_base =  1000000000
-#elif	_XBM_ATOM_LEN == 64
-#define 	atom_base  (UI64(1000000000000000000))
+void	xbmath::natural::to_str(kernel::str_writer& w,int base,int width) const
+{
+    if( base < 2 || base > 36 ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_invalid_base);
 #else
-	    atom_base =  1000000000
+	assert( base >= 2 && base <= 36 );
+	return;
 #endif
-    };
-    container summ;
-    container pow2;
-
-    pow2.insert(pow2.begin(),1);
-    summ.insert(summ.begin(),0);
-
-    const_iterator i = p.begin();
-    const_iterator i_end = p.end();
-    int shift_c = 0;
-    for( ; i != i_end; ++i ) {
-	register atom  b = first_bit;
-	int left_bits = atom_bits;
-	register atom act = *i;
-	if( act != 0 )
-	    do {
-		if( act & b ) {
-		    while( shift_c > 0 ) {
-			xbmath::dec_add<atom_base>::add_container(pow2,pow2);
-			shift_c--;
-		    }
-		    xbmath::dec_add<atom_base>::add_container(summ,pow2);
-		    shift_c = 0;
-		}
-		shift_c++;
-		b <<= 1;
-		--left_bits;
-		if( b > act ) {
-		    shift_c += left_bits;
-		    break;
-		}
-	    } while( b != 0 ); /* iterate bits in atom */
-	    else {
-		shift_c += atom_bits;
-	    }
-    } /* iterate atoms */
-    { // output summ iterator to buffer
-	const_iterator start = summ.begin();
-	const_iterator i = summ.end();
-	char nbuf[4*sizeof(atom)];
-	char* s = buf;
-	int l = 0;
-	buf[0] = '\0';
-	do {
-	    if( l )
-		sprintf(nbuf,XBM_ATOM_FMT_DEC_PAD, *(--i));
-	    else
-		sprintf(nbuf,XBM_ATOM_FMT_DEC, *(--i));
-	    l = 1;
-	    if( max == 0 )
-		return;
-	    strncpy(s,nbuf,max-1);
-	    s[max-1] = '\0';
-	    {
-		int k = strlen(nbuf);
-		max -= k;
-		s += k;
-	    }
-	} while ( i != start );
     }
-#if	_XBM_ATOM_LEN == 64
-#undef atom_base
+    kernel::size_type n = p.size();
+    kernel::to_str(w,n ? &p[0] : NULL,n,base,width > 0 ? width : 0);
+}
+
+bool	xbmath::natural::read_file(FILE* f,int base)
+{
+    if( base < 2 || base > 36 ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_invalid_base);
+#else
+	assert( base >= 2 && base <= 36 );
+	return false;
 #endif
+    }
+    return read_number(::read_file,f,base,p,NULL);
 }
 
+bool	xbmath::natural::read_fd(int fd,int base)
+{
+    if( base < 2 || base > 36 ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_invalid_base);
+#else
+	assert( base >= 2 && base <= 36 );
+	return false;
+#endif
+    }
+    return read_number(::read_fd,&fd,base,p,NULL);
+}
 
-void	xbmath::natural::str_hex(char* buf,int max) const
+bool	xbmath::integer::read_file(FILE* f,int base)
 {
-    if( buf == NULL || max <= 0 )
+    sign = true;
+    if( base < 2 || base > 36 )
+	return natural::read_file(f,base);
+    bool ok = read_number(::read_file,f,base,p,&sign);
+    if( is_zero() )
+	sign = true;		// "-0" is zero
+    return ok;
+}
+
+bool	xbmath::integer::read_fd(int fd,int base)
+{
+    sign = true;
+    if( base < 2 || base > 36 )
+	return natural::read_fd(fd,base);
+    bool ok = read_number(::read_fd,&fd,base,p,&sign);
+    if( is_zero() )
+	sign = true;		// "-0" is zero
+    return ok;
+}
+
+#ifndef XBM_NO_IOSTREAM
+static bool read_stream(std::istream& s,int base,xbmath::container& p)
+/*
+    Digits of base up to the first other character, which stays in
+    the stream; sets eofbit and failbit as operator >> for ints.
+*/
+{
+    typedef std::char_traits<char> traits;
+    xbmath::kernel::str_reader r(base);
+    std::streambuf* b = s.rdbuf();
+    std::ios::iostate state = std::ios::goodbit;
+    char buf[4096];
+    size_t n = 0;
+    for( traits::int_type c = b->sgetc(); ; c = b->snextc() ) {
+	if( traits::eq_int_type(c,traits::eof()) ) {
+	    state |= std::ios::eofbit;
+	    break;
+	}
+	if( digit_value(c) >= base )
+	    break;
+	buf[n++] = traits::to_char_type(c);
+	if( n == sizeof buf ) {
+	    r.put(buf,n);
+	    n = 0;
+	}
+    }
+    r.put(buf,n);
+    bool ok = r.digits() > 0;
+    if( ok )
+	r.get(p);
+    else
+	state |= std::ios::failbit;
+    s.setstate(state);
+    return ok;
+}
+
+std::istream& xbmath::natural::read(std::istream& s,int base)
+{
+    if( base < 2 || base > 36 ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_invalid_base);
+#else
+	assert( base >= 2 && base <= 36 );
+	s.setstate(std::ios::failbit);
+	return s;
+#endif
+    }
+    std::istream::sentry ok(s);
+    if( ok )
+	read_stream(s,base,p);
+    return s;
+}
+
+std::istream& xbmath::integer::read(std::istream& s,int base)
+{
+    if( base < 2 || base > 36 )
+	return natural::read(s,base);
+    std::istream::sentry ok(s);
+    if( !ok )
+	return s;
+    typedef std::char_traits<char> traits;
+    traits::int_type c = s.rdbuf()->sgetc();
+    bool positive = !traits::eq_int_type(c,traits::to_int_type('-'));
+    if( !positive || traits::eq_int_type(c,traits::to_int_type('+')) )
+	s.rdbuf()->sbumpc();
+    if( read_stream(s,base,p) )
+	sign = positive || is_zero();
+    return s;
+}
+#endif // XBM_NO_IOSTREAM
+
+/*
+    Binary record, version 1:
+
+	0   'X' 'B' 'M' 1	magic and version
+	4   sign		0 non-negative, 1 negative
+	5   limb width		bytes per limb
+	6   endianness		of a limb, 0 little, 1 big
+	7   0			reserved
+	8   limb count		64 bits, little endian
+	16  limbs		least significant first
+
+    Records are written with native limbs; reading them where limb
+    width and endianness match is a plain copy, anything else is
+    repacked byte by byte.
+*/
+enum { bin_version = 1, bin_header = 16 };
+
+static bool bin_native_big()
+{
+    const xbmath::atom one = 1;
+    return *(const unsigned char*)&one == 0;
+}
+
+static void bin_header_put(unsigned char* d,size_t n,bool negative)
+/* header of a record of n native limbs */
+{
+    d[0] = 'X';
+    d[1] = 'B';
+    d[2] = 'M';
+    d[3] = bin_version;
+    d[4] = negative && n > 0;
+    d[5] = sizeof(xbmath::atom);
+    d[6] = bin_native_big();
+    d[7] = 0;
+    for( unsigned i = 0; i < 8; ++i )
+	d[8+i] = (unsigned char)(i < sizeof(size_t) ? (n >> (8*i)) & 0xff : 0);
+}
+
+static bool bin_header_get(const unsigned char* s,size_t len,size_t& n)
+/* a valid header whose n limbs fit in len bytes */
+{
+    if( s == NULL || len < bin_header || s[0] != 'X' || s[1] != 'B' || s[2] != 'M' ||
+	s[3] != bin_version || s[4] > 1 || s[5] == 0 || s[6] > 1 )
+	return false;
+    n = 0;
+    for( unsigned i = 0; i < 8; ++i ) {
+	if( i >= sizeof(size_t) && s[8+i] )
+	    return false;
+	if( i < sizeof(size_t) )
+	    n |= (size_t)s[8+i] << (8*i);
+    }
+    return n <= (len - bin_header) / s[5];
+}
+
+static bool bin_native(const unsigned char* s,size_t len,size_t& n)
+/* header of native limbs, which can be used in place */
+{
+    return bin_header_get(s,len,n) && s[5] == sizeof(xbmath::atom) &&
+	(s[6] != 0) == bin_native_big();
+}
+
+static size_t bin_put(unsigned char* d,size_t max,const xbmath::container& p,bool negative)
+{
+    size_t n = xbmath::kernel::normalize(p.empty() ? NULL : &p[0],p.size());
+    size_t len = bin_header + n*sizeof(xbmath::atom);
+    if( d == NULL || max < len )
+	return 0;
+    bin_header_put(d,n,negative);
+    if( n )
+	memcpy(d + bin_header,&p[0],n*sizeof(xbmath::atom));
+    return len;
+}
+
+static size_t bin_get(const unsigned char* s,size_t len,xbmath::container& p,bool& negative)
+{
+    size_t n;
+    if( !bin_header_get(s,len,n) )
+	return 0;
+    const size_t w = s[5];
+    const size_t bytes = n*w;
+    const unsigned char* l = s + bin_header;
+    xbmath::container r((bytes + sizeof(xbmath::atom) - 1) / sizeof(xbmath::atom) + 1,0);
+    if( w == sizeof(xbmath::atom) && (s[6] != 0) == bin_native_big() )
+	memcpy(&r[0],l,bytes);
+    else {
+	// byte k of the number is byte k % w of limb k / w
+	for( size_t k = 0; k < bytes; ++k ) {
+	    size_t j = k % w;
+	    xbmath::atom b = l[k - j + (s[6] ? w - 1 - j : j)];
+	    r[k / sizeof(xbmath::atom)] |= b << (8 * (k % sizeof(xbmath::atom)));
+	}
+    }
+    r.resize(xbmath::kernel::normalize(&r[0],r.size()));
+    if( r.empty() )
+	r.push_back(0);
+    p.swap(r);
+    negative = s[4] && !(p.size() == 1 && p[0] == 0);
+    return bin_header + bytes;
+}
+
+/*
+    Memory resources. The arena and the pool keep their bookkeeping
+    in the storage itself: a block header before the arena's bump
+    space, the free list links in the freed pieces of the pool.
+*/
+static XBM_THREAD_LOCAL xbmath::memory_resource* current_resource;
+
+xbmath::memory_resource* xbmath::memory_resource::current()
+{
+    return current_resource;
+}
+
+xbmath::memory_resource* xbmath::memory_resource::set_current(memory_resource* r)
+{
+    memory_resource* prev = current_resource;
+    current_resource = r;
+    return prev;
+}
+
+struct xbmath::arena::block {
+    block*  next;
+    size_t  align;	// keeps the space after it aligned for atoms
+};
+
+void*	xbmath::arena::allocate(size_t bytes)
+{
+    bytes = (bytes + sizeof(block) - 1) & ~(sizeof(block) - 1);
+    if( head == 0 || (size_t)(end - top) < bytes ) {
+	size_t b = bytes > block_bytes ? bytes : block_bytes;
+	block* k = (block*)malloc(sizeof(block) + b);
+	if( k == NULL )
+	    return NULL;
+	k->next = head;
+	head = k;
+	top = (char*)(k + 1);
+	end = top + b;
+    }
+    void* p = top;
+    top += bytes;
+    return p;
+}
+
+void	xbmath::arena::deallocate(void* p,size_t bytes)
+{
+    bytes = (bytes + sizeof(block) - 1) & ~(sizeof(block) - 1);
+    if( (char*)p + bytes == top )
+	top = (char*)p;
+}
+
+void	xbmath::arena::release()
+{
+    while( head ) {
+	block* k = head->next;
+	free(head);
+	head = k;
+    }
+    top = end = 0;
+}
+
+xbmath::pool::pool()
+{
+    for( int i = 0; i < classes; ++i )
+	free_list[i] = 0;
+}
+
+xbmath::pool::~pool()
+{
+    for( int i = 0; i < classes; ++i )
+	while( node* k = free_list[i] ) {
+	    free_list[i] = k->next;
+	    free(k);
+	}
+}
+
+static int pool_class(size_t bytes,int min_shift)
+/* i for sizes up to 2^(min_shift+i) */
+{
+    int i = 0;
+    while( ((size_t)1 << (min_shift + i)) < bytes )
+	++i;
+    return i;
+}
+
+void*	xbmath::pool::allocate(size_t bytes)
+{
+    const int i = pool_class(bytes,min_shift);
+    if( i >= classes )
+	return malloc(bytes);
+    if( node* k = free_list[i] ) {
+	free_list[i] = k->next;
+	return k;
+    }
+    return malloc((size_t)1 << (min_shift + i));
+}
+
+void	xbmath::pool::deallocate(void* p,size_t bytes)
+{
+    const int i = pool_class(bytes,min_shift);
+    if( i >= classes ) {
+	free(p);
 	return;
-    else if( p.size() == 0 ) {
-	strncpy(buf,"0",max);
-    } else {
-	const_iterator start = p.begin();
-	const_iterator i = p.end();
-	char nbuf[2*sizeof(atom) + 2 ];
-	char* s = buf;
-	int l = 0;
-	buf[0] = '\0';
-	do {
-	    if( l )
-		sprintf(nbuf,XBM_ATOM_FMT_HEX_PAD, *(--i));
-	    else
-		sprintf(nbuf,XBM_ATOM_FMT_HEX, *(--i));
-	    l = 1;
-	    strncat(s,nbuf,max-1);
-	    s[max-1] = '\0';
-	    {
-		int k = strlen(buf);
-		max-= k;
-		s+= k;
-	    }
-	} while ( i != start );
     }
-} // strhex
+    node* k = (node*)p;
+    k->next = free_list[i];
+    free_list[i] = k;
+}
 
-xbmath::natural& xbmath::natural::inc()
+/*
+    Shared blocks: a header with the reference count, padded to keep
+    the atoms aligned, before the atoms.
+*/
+#if __cplusplus >= 201103L
+typedef std::atomic<size_t> ref_count;
+#define ref_hold(c)	((c).fetch_add(1,std::memory_order_relaxed))
+#define ref_drop(c)	((c).fetch_sub(1,std::memory_order_acq_rel) - 1)
+#define ref_get(c)	((c).load(std::memory_order_acquire))
+#elif defined __GNUC__
+typedef size_t ref_count;
+#define ref_hold(c)	(__sync_fetch_and_add(&(c),1))
+#define ref_drop(c)	(__sync_sub_and_fetch(&(c),1))
+#define ref_get(c)	(__sync_fetch_and_add(&(c),0))
+#else
+typedef size_t ref_count;	// no atomics: copies stay in one thread
+#define ref_hold(c)	(++(c))
+#define ref_drop(c)	(--(c))
+#define ref_get(c)	(c)
+#endif
+
+enum { shared_header = 16 };
+
+static inline ref_count& shared_refs(const void* p)
 {
-    if( p.size() == 0 )
-	p.insert(p.end(),1);
+    return *(ref_count*)((char*)p - shared_header);
+}
+
+xbmath::shared_limbs xbmath::shared_limbs::resource;
+
+void*	xbmath::shared_limbs::allocate(size_t bytes)
+{
+    char* h = (char*)malloc(shared_header + bytes);
+    if( h == NULL )
+	return NULL;
+    new (h) ref_count(1);
+    return h + shared_header;
+}
+
+void	xbmath::shared_limbs::deallocate(void* p,size_t)
+{
+    if( ref_drop(shared_refs(p)) == 0 ) {
+	shared_refs(p).~ref_count();
+	free((char*)p - shared_header);
+    }
+}
+
+void*	xbmath::shared_limbs::hold(void* p)
+{
+    ref_hold(shared_refs(p));
+    return p;
+}
+
+bool	xbmath::shared_limbs::sole(const void* p)
+{
+    return ref_get(shared_refs(p)) == 1;
+}
+
+/*
+    Limb storage. Heap limbs come from malloc or the thread's memory
+    resource, atoms need no construction. A shared map is the file
+    of a binary record with room for cap limbs after the header; its
+    header gets the limb count when synced or unmapped, and the file
+    is cut to the record.
+*/
+struct xbmath::limbs::mapping {
+    int	    fd;		// shared map, -1 for a private one
+    void*   base;
+    size_t  bytes;
+};
+
+#ifdef XBM_HAVE_MMAP
+static bool map_resize(int fd,void*& base,size_t& bytes,size_t limbs)
+/* file and shared map for limbs; the old map stays on failure */
+{
+    const size_t b = bin_header + limbs*sizeof(xbmath::atom);
+    if( b > bytes && ftruncate(fd,b) != 0 )
+	return false;
+    void* t = mmap(NULL,b,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    if( t == MAP_FAILED )
+	return false;
+    if( base )
+	munmap(base,bytes);
+    base = t;
+    bytes = b;
+    return true;
+}
+#endif
+
+void	xbmath::limbs::grow(size_type c,bool discard)
+{
+    if( !discard && c < 2*cap )
+	c = 2*cap;
+#ifdef XBM_HAVE_MMAP
+    if( shared() ) {
+	if( !map_resize(m->fd,m->base,m->bytes,c) )
+	    throw std::bad_alloc();
+	d = (atom*)((char*)m->base + bin_header);
+	cap = c;
+	return;
+    }
+#endif
+    // a private map moves to the heap
+    relocate(c,!discard);
+}
+
+void	xbmath::limbs::relocate(size_type c,bool keep)
+/* heap limbs of c from the thread's resource */
+{
+    memory_resource* a = memory_resource::current();
+    atom* t = (atom*)(a ? a->allocate(c*sizeof(atom)) : malloc(c*sizeof(atom)));
+    if( t == NULL )
+	throw std::bad_alloc();
+    if( keep && n )
+	memcpy(t,d,n*sizeof(atom));
+    if( m ) {
+	size_type k = n;
+	release();
+	n = k;
+    } else if( d != in )
+	heap_free();
+    d = t;
+    cap = c;
+    r = a;
+}
+
+void	xbmath::limbs::release()
+{
+    if( m == 0 ) {
+	if( d != in )
+	    heap_free();
+    }
+#ifdef XBM_HAVE_MMAP
     else {
-	iterator i = p.begin();
-	if( ++(*i) == 0 ) {
-	    iterator end = p.end();
-	    int cf = 1;
-	    while( ++i != end && cf )
-		cf = (++(*i) == 0);
-	    if( cf )
-		p.insert(p.end(),1);
+	if( m->fd >= 0 ) {
+	    bin_header_put((unsigned char*)m->base,n,false);
+	    munmap(m->base,m->bytes);
+	    if( ftruncate(m->fd,bin_header + n*sizeof(atom)) != 0 )
+		; // the record is whole, only longer
+	    ::close(m->fd);
+	} else
+	    munmap(m->base,m->bytes);
+	delete m;
+    }
+#endif
+    d = in;
+    n = 0;
+    cap = inline_limbs;
+    m = 0;
+    r = 0;
+}
+
+void	xbmath::limbs::share(const limbs& o)
+{
+    atom* t = (atom*)shared_limbs::hold(o.d);	// o may be in this block
+    if( d != in )
+	heap_free();
+    d = t;
+    n = o.n;
+    cap = o.cap;
+    r = o.r;
+}
+
+void	xbmath::limbs::unshare(bool keep)
+{
+    if( !shared_limbs::sole(d) )
+	relocate(cap,keep);
+}
+
+void	xbmath::limbs::swap_values(limbs& o)
+{
+    if( !((m || o.m) && (shared() || o.shared())) ) {
+	// inline limbs are copied, other storage changes hands
+	limbs& a = d == in ? *this : o;
+	limbs& b = d == in ? o : *this;
+	atom t[inline_limbs];
+	memcpy(t,a.in,a.n*sizeof(atom));
+	const size_type k = a.n;
+	if( b.d == b.in ) {
+	    memcpy(a.in,b.in,b.n*sizeof(atom));
+	    a.n = b.n;
+	} else {
+	    a.d = b.d;
+	    a.n = b.n;
+	    a.cap = b.cap;
+	    a.m = b.m;
+	    a.r = b.r;
+	    b.d = b.in;
+	    b.cap = inline_limbs;
+	    b.m = 0;
+	    b.r = 0;
+	}
+	memcpy(b.in,t,k*sizeof(atom));
+	b.n = k;
+	return;
+    }
+    // shared maps keep their storage, values are exchanged in place;
+    // a copy on write block is cloned first, its other holders keep it
+    own();
+    o.own();
+    const size_type a = n;
+    const size_type b = o.n;
+    reserve(b);
+    o.reserve(a);
+    const size_type k = a < b ? a : b;
+    for( size_type i = 0; i < k; ++i ) {
+	atom t = d[i];
+	d[i] = o.d[i];
+	o.d[i] = t;
+    }
+    if( b > a )
+	memcpy(d + a,o.d + a,(b - a)*sizeof(atom));
+    else if( a > b )
+	memcpy(o.d + b,d + b,(a - b)*sizeof(atom));
+    n = b;
+    o.n = a;
+}
+
+bool	xbmath::limbs::shared() const
+{
+    return m && m->fd >= 0;
+}
+
+bool	xbmath::limbs::map_private(const char* path,bool* negative)
+{
+#ifdef XBM_HAVE_MMAP
+    int fd = ::open(path,O_RDONLY);
+    if( fd < 0 )
+	return false;
+    struct stat st;
+    void* base = MAP_FAILED;
+    if( fstat(fd,&st) == 0 && st.st_size >= bin_header )
+	base = mmap(NULL,st.st_size,PROT_READ|PROT_WRITE,MAP_PRIVATE,fd,0);
+    ::close(fd);
+    if( base == MAP_FAILED )
+	return false;
+    size_t c;
+    if( !bin_native((const unsigned char*)base,st.st_size,c) ) {
+	munmap(base,st.st_size);
+	return false;
+    }
+    if( negative )
+	*negative = ((const unsigned char*)base)[4] != 0;
+    release();
+    m = new mapping;
+    m->fd = -1;
+    m->base = base;
+    m->bytes = st.st_size;
+    d = (atom*)((char*)base + bin_header);
+    n = cap = c;
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool	xbmath::limbs::map_shared(const char* path,bool create)
+{
+#ifdef XBM_HAVE_MMAP
+    int fd = ::open(path,create ? O_RDWR|O_CREAT|O_TRUNC : O_RDWR,0666);
+    if( fd < 0 )
+	return false;
+    size_t c = n;
+    if( !create ) {
+	unsigned char h[bin_header];
+	struct stat st;
+	if( fstat(fd,&st) != 0 || ::read(fd,h,bin_header) != bin_header ||
+	    !bin_native(h,st.st_size,c) || h[4] != 0 ) {
+	    ::close(fd);
+	    return false;
+	}
+    }
+    void* base = NULL;
+    size_t bytes = 0;
+    if( !map_resize(fd,base,bytes,c ? c : 1) ) {
+	::close(fd);
+	return false;
+    }
+    atom* t = (atom*)((char*)base + bin_header);
+    if( create ) {
+	if( n )
+	    memcpy(t,d,n*sizeof(atom));
+	bin_header_put((unsigned char*)base,n,false);
+    }
+    release();
+    m = new mapping;
+    m->fd = fd;
+    m->base = base;
+    m->bytes = bytes;
+    d = t;
+    n = c;
+    cap = (bytes - bin_header) / sizeof(atom);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void	xbmath::limbs::unmap()
+{
+    if( m == 0 )
+	return;
+    limbs t(d,d + n);
+    release();
+    swap(t);
+}
+
+bool	xbmath::limbs::sync()
+{
+#ifdef XBM_HAVE_MMAP
+    if( !shared() )
+	return false;
+    bin_header_put((unsigned char*)m->base,n,false);
+    return msync(m->base,m->bytes,MS_SYNC) == 0;
+#else
+    return false;
+#endif
+}
+
+static bool bin_map(const char* path,xbmath::container& p,bool& negative)
+/* p from a record file, mapped when its limbs are native */
+{
+    xbmath::container r;
+    if( r.map_private(path,&negative) ) {
+	while( r.size() > 1 && r.back() == 0 )
+	    r.pop_back();
+	negative = negative && !r.empty() && !(r.size() == 1 && r[0] == 0);
+    } else {
+	// other limbs or no mmap: read and convert
+	FILE* f = fopen(path,"rb");
+	if( f == NULL )
+	    return false;
+	std::vector<unsigned char> b;
+	unsigned char t[1 << 16];
+	size_t k;
+	while( (k = fread(t,1,sizeof t,f)) > 0 )
+	    b.insert(b.end(),t,t + k);
+	fclose(f);
+	if( b.empty() || bin_get(&b[0],b.size(),r,negative) == 0 )
+	    return false;
+    }
+    if( r.empty() )
+	r.push_back(0);
+    p.swap(r);
+    return true;
+}
+
+bool	xbmath::natural::map_bin(const char* path)
+{
+    container r;
+    bool negative;
+    if( !bin_map(path,r,negative) || negative )
+	return false;
+    p.swap(r);
+    return true;
+}
+
+bool	xbmath::integer::map_bin(const char* path)
+{
+    container r;
+    bool negative;
+    if( !bin_map(path,r,negative) )
+	return false;
+    p.swap(r);
+    sign = !negative;
+    return true;
+}
+
+bool	xbmath::natural::map_file(const char* path,bool create)
+{
+    if( !p.map_shared(path,create) )
+	return false;
+    while( p.size() > 1 && p.back() == 0 )
+	p.pop_back();
+    if( p.empty() )
+	p.push_back(0);
+    return true;
+}
+
+bool	xbmath::integer::map_file(const char* path,bool create)
+{
+    if( create && !sign )
+	return false;
+    if( !natural::map_file(path,create) )
+	return false;
+    sign = true;
+    return true;
+}
+
+size_t	xbmath::natural::bin_length() const
+{
+    return bin_header + kernel::normalize(p.empty() ? NULL : &p[0],p.size())*sizeof(atom);
+}
+
+size_t	xbmath::natural::to_bin(void* buf,size_t max) const
+{
+    return bin_put((unsigned char*)buf,max,p,false);
+}
+
+size_t	xbmath::natural::set_bin(const void* buf,size_t len)
+{
+    container r;
+    bool negative;
+    size_t n = bin_get((const unsigned char*)buf,len,r,negative);
+    if( n == 0 || negative )
+	return 0;
+    p.swap(r);
+    return n;
+}
+
+bool	xbmath::natural::write_bin(FILE* f) const
+{
+    unsigned char h[bin_header];
+    size_t n = kernel::normalize(p.empty() ? NULL : &p[0],p.size());
+    bin_header_put(h,n,false);
+    return fwrite(h,1,bin_header,f) == bin_header &&
+	(n == 0 || fwrite(&p[0],sizeof(atom),n,f) == n);
+}
+
+bool	xbmath::natural::read_bin(FILE* f)
+{
+    unsigned char h[bin_header];
+    size_t n;
+    if( fread(h,1,bin_header,f) != bin_header || h[4] != 0 ||
+	!bin_header_get(h,~(size_t)0,n) )
+	return false;
+    container r;
+    if( bin_native(h,~(size_t)0,n) ) {
+	r.resize(n ? n : 1);
+	if( fread(&r[0],sizeof(atom),n,f) != n )
+	    return false;
+    } else {
+	// other limbs: the record in memory, converted
+	std::vector<unsigned char> b(bin_header + n*h[5]);
+	memcpy(&b[0],h,bin_header);
+	bool negative;
+	if( fread(&b[bin_header],1,b.size() - bin_header,f) != b.size() - bin_header ||
+	    bin_get(&b[0],b.size(),r,negative) == 0 )
+	    return false;
+    }
+    while( r.size() > 1 && r.back() == 0 )
+	r.pop_back();
+    p.swap(r);
+    return true;
+}
+
+/*
+    Checkpoint file:
+
+	0   'X' 'B' 'M' 'C'	magic
+	4   1			version
+	5   kind		1 factorial, 2 pow
+	6   0 0
+	8   argument		f or e, 64 bits little endian
+	16  position		next factor or exponent left
+	24  base hash		pow: of the limbs of the base
+	32  records		the product; pow: then the square
+*/
+enum { ckpt_factorial = 1, ckpt_pow = 2, ckpt_header = 32 };
+
+static void ckpt_put64(unsigned char* d,unsigned long long x)
+{
+    for( unsigned i = 0; i < 8; ++i )
+	d[i] = (unsigned char)(x >> (8*i));
+}
+
+static unsigned long long ckpt_get64(const unsigned char* s)
+{
+    unsigned long long x = 0;
+    for( unsigned i = 0; i < 8; ++i )
+	x |= (unsigned long long)s[i] << (8*i);
+    return x;
+}
+
+static unsigned long long ckpt_hash(const xbmath::container& p)
+/* FNV-1a of the limbs */
+{
+    unsigned long long h = 14695981039346656037ULL;
+    size_t n = xbmath::kernel::normalize(p.empty() ? NULL : &p[0],p.size());
+    const unsigned char* b = (const unsigned char*)(n ? &p[0] : NULL);
+    for( size_t i = 0; i < n*sizeof(xbmath::atom); ++i )
+	h = (h ^ b[i]) * 1099511628211ULL;
+    return h;
+}
+
+static bool ckpt_save(const xbmath::checkpoint& c,int kind,unsigned long long arg,
+		      unsigned long long pos,unsigned long long hash,
+		      const xbmath::natural& a,const xbmath::natural* b)
+/* to a temporary file renamed over the last one */
+{
+    xbmath::string tmp = c.path + ".tmp";
+    FILE* f = fopen(tmp.c_str(),"wb");
+    if( f == NULL )
+	return false;
+    unsigned char h[ckpt_header];
+    memcpy(h,"XBMC",4);
+    h[4] = 1;
+    h[5] = (unsigned char)kind;
+    h[6] = h[7] = 0;
+    ckpt_put64(h + 8,arg);
+    ckpt_put64(h + 16,pos);
+    ckpt_put64(h + 24,hash);
+    bool ok = fwrite(h,1,ckpt_header,f) == ckpt_header && a.write_bin(f) &&
+	(b == NULL || b->write_bin(f));
+    ok = fclose(f) == 0 && ok;
+    if( ok )
+	ok = rename(tmp.c_str(),c.path.c_str()) == 0;
+    if( !ok )
+	remove(tmp.c_str());
+    return ok;
+}
+
+static void ckpt_failed()
+/* a run that cannot be resumed stops here */
+{
+#ifdef XBM_WITH_EXCEPTIONS
+    throw xbmath::exception(xbmath::exception::exc_checkpoint);
+#else
+    assert( !"checkpoint not saved" );
+#endif
+}
+
+static bool ckpt_load(const xbmath::checkpoint& c,int kind,unsigned long long arg,
+		      unsigned long long& pos,unsigned long long hash,
+		      xbmath::natural& a,xbmath::natural* b)
+/* state of the same computation, if saved */
+{
+    FILE* f = fopen(c.path.c_str(),"rb");
+    if( f == NULL )
+	return false;
+    unsigned char h[ckpt_header];
+    xbmath::natural x;
+    xbmath::natural y;
+    bool ok = fread(h,1,ckpt_header,f) == ckpt_header &&
+	memcmp(h,"XBMC",4) == 0 && h[4] == 1 && h[5] == kind &&
+	ckpt_get64(h + 8) == arg && ckpt_get64(h + 24) == hash &&
+	x.read_bin(f) && (b == NULL || y.read_bin(f));
+    fclose(f);
+    if( !ok )
+	return false;
+    // factorial: the next factor, up to arg + 1; pow: exponent left
+    const unsigned long long at = ckpt_get64(h + 16);
+    if( at == 0 || (kind == ckpt_factorial ? at - 1 : at) > arg )
+	return false;
+    pos = at;
+    a.swap(x);
+    if( b )
+	b->swap(y);
+    return true;
+}
+
+xbmath::natural& xbmath::natural::factorial(atom f,const checkpoint& c)
+{
+    // r = product of the factors from 2 up to i-1
+    unsigned long long i = 2;
+    natural r(1);
+    ckpt_load(c,ckpt_factorial,f,i,0,r,NULL);
+    time_t last = time(NULL);
+    for( ; i <= f; ++i ) {
+	r.mul((atom)i);
+	if( (i & 255) == 0 && time(NULL) - last >= (time_t)c.interval ) {
+	    if( !ckpt_save(c,ckpt_factorial,f,i+1,0,r,NULL) )
+		ckpt_failed();
+	    last = time(NULL);
 	}
     }
+    p.swap(r.p);
+    remove(c.path.c_str());
     return *this;
 }
 
-xbmath::natural& xbmath::natural::add (xbmath::atom t)
+xbmath::natural& xbmath::natural::pow(unsigned long e,const checkpoint& c)
 {
-    iterator i = p.begin(),
-	end = p.end();
-    bool cf = false;
-    if( i == end )
-	p.insert(end,t);
-    else {
-	(*i) += t;
-	cf = (*i < t);
-	while( cf ) {
-	    i++;
-	    if( i == end ) {
-		p.insert(i,1);
-		break;
-	    } else
-		cf = (++(*i) == 0);
+    // result r * s^k, k the exponent left
+    const unsigned long long hash = ckpt_hash(p);
+    unsigned long long k = e;
+    natural r(1);
+    natural s(*this);
+    ckpt_load(c,ckpt_pow,e,k,hash,r,&s);
+    time_t last = time(NULL);
+    while( k > 0 ) {
+	if( k & 1 )
+	    r.mul(s);
+	k >>= 1;
+	if( k )
+	    s.sqr();
+	if( k && time(NULL) - last >= (time_t)c.interval ) {
+	    if( !ckpt_save(c,ckpt_pow,e,k,hash,r,&s) )
+		ckpt_failed();
+	    last = time(NULL);
 	}
     }
+    p.swap(r.p);
+    remove(c.path.c_str());
+    return *this;
+}
+
+size_t	xbmath::integer::to_bin(void* buf,size_t max) const
+{
+    return bin_put((unsigned char*)buf,max,p,!sign);
+}
+
+size_t	xbmath::integer::set_bin(const void* buf,size_t len)
+{
+    container r;
+    bool negative;
+    size_t n = bin_get((const unsigned char*)buf,len,r,negative);
+    if( n == 0 )
+	return 0;
+    p.swap(r);
+    sign = !negative;
+    return n;
+}
+
+int	xbmath::natural::leading_digits(char* buf,int len,int base) const
+{
+    kernel::size_type n = kernel::str_leading(buf,p.empty() ? NULL : &p[0],p.size(),len,base);
+    buf[n] = '\0';
+    return (int)n;
+}
+
+int	xbmath::natural::trailing_digits(char* buf,int len,int base) const
+{
+    kernel::size_type n = kernel::str_trailing(buf,p.empty() ? NULL : &p[0],p.size(),len,base);
+    buf[n] = '\0';
+    return (int)n;
+}
+
+xbmath::natural& xbmath::natural::inc()
+{
+    return add((atom)1);
+}
+
+xbmath::natural& xbmath::natural::add (xbmath::atom t)
+{
+    if( p.size() == 0 )
+	p.insert(p.end(),t);
+    else if( kernel::add_1(&p[0],&p[0],p.size(),t) )
+	p.insert(p.end(),1);
     return *this;
 }
 
 xbmath::natural& xbmath::natural::add (const xbmath::natural& n)
 {
-    const container& q = n.p;
-    iterator i = p.begin();
-    const_iterator j = q.begin();
-    bool cf = false;
-
-    int len = p.size() > q.size() ? q.size() : p.size();
-    for(int l=0;l < len; ++l,++i,++j) {
-	register atom iv = *i;
-	register atom jv = *j;
-	register atom t = iv + jv + cf;
-	if( iv > jv ) {
-	    cf = t < iv;
-	} else {
-	    cf = t < jv;
-	}
-	*i = t;
-    }
-    if( j != q.end() ) {
-	if( cf ) {
-	    do {
-		register atom t = *j++ + 1;
-		p.insert(p.end(),t);
-		if( t != 0 ) {	// no carry
-		    // append q.[j, ... ] to p
-		    p.insert( p.end(), j, q.end());
-		    return *this;
-		}
-		// there is carry
-	    } while( j != q.end());
-	} else {
-	    // append q.[j, ... ] to p
-	    p.insert( p.end(), j, q.end());
-	}
-    } else if( cf && i != p.end() ) {
-	do {
-	    if( !(cf = ++(*i) == 0) )
-		return *this;
-	} while( ++i != p.end());
+    return add_atoms(&n.p[0],n.p.size());
+}
+
+xbmath::natural& xbmath::natural::add_atoms(const atom* b,kernel::size_type bn)
+{
+    kernel::size_type an = p.size();
+    atom cf;
+    if( bn == 0 )
+	return *this;
+    if( an >= bn )
+	cf = kernel::add(&p[0],&p[0],an,b,bn);
+    else {
+	p.resize(bn);
+	cf = kernel::add(&p[0],b,bn,&p[0],an);
     }
     if( cf )
-	p.insert(p.end(),1);
+	p.insert(p.end(),cf);
     return *this;
 } // add
 
 xbmath::natural& xbmath::natural::mul (xbmath::atom act)
 {
     if( act == 0 ) return zero();
-    if( act == 1 ) return *this;
-    natural summ;
-    unsigned int shift_c = 0;
-    register atom b = first_bit;
-    int left_bits = atom_bits;
-    do {
-	if( act & b ) {
-	    if( shift_c > 0 )
-		shift_left(shift_c);
-	    summ.add(*this);
-	    shift_c = 0;
-	}
-	shift_c++;
-	b = b << 1;
-	--left_bits;
-	if( b > act ) {
-	    shift_c += left_bits;
-	    break;
-	}
-    } while( b != 0 );
-    *this = summ;
+    if( act == 1 || p.size() == 0 ) return *this;
+    atom high = kernel::mul_1(&p[0],&p[0],p.size(),act);
+    if( high )
+	p.insert(p.end(),high);
     return *this;
 } // mul with atom
 
+xbmath::atom xbmath::natural::div_1(const xbmath::kernel::inverse_1& d)
+{
+    if( d.d == 0 ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_division_by_zero);
+#else
+	assert( d.d != 0 );
+	return 0;
+#endif
+    }
+    atom r = kernel::divrem_1(&p[0],&p[0],p.size(),d);
+    delete_zeroes();
+    return r;
+} // div with atom
+
+xbmath::atom xbmath::natural::mod_1(const xbmath::kernel::inverse_1& d) const
+{
+    if( d.d == 0 ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_division_by_zero);
+#else
+	assert( d.d != 0 );
+	return 0;
+#endif
+    }
+    return kernel::mod_1(&p[0],p.size(),d);
+} // mod with atom
+
 xbmath::natural& xbmath::natural::sqr (int n)
 {
-    natural summ;
-    natural org;
+    if( is_zero() )
+	return *this;
     while ( n > 0 ) {
-	summ.zero();
-	org = *this;
-	iterator i     = org.p.begin(),
-	    i_end = org.p.end();
-	int shift_c = 0;
-	for( ; i != i_end; ++i ) {
-	    register atom  b = first_bit;
-	    int left_bits = atom_bits;
-	    register atom act = *i;
-	    do {
-		if( act & b ) {
-		    if( shift_c > 0 )
-			shift_left(shift_c);
-		    summ.add(*this);
-		    shift_c = 0;
-		}
-		shift_c++;
-		b = b << 1;
-		--left_bits;
-		if( b > act ) {
-		    shift_c += left_bits;
-		    break;
-		}
-	    } while( b != 0 );
-	}
-	*this = summ;
+	// the product in scratch, back into the limbs p already has
+	const kernel::size_type k = 2*p.size();
+	kernel::scratch r(k);
+	kernel::sqr(r,&p[0],p.size());
+	p.assign(r,r + kernel::normalize(r,k));
 	n--;
     }
     return *this;
@@ -343,31 +1269,17 @@ xbmath::natural& xbmath::natural::sqr (int n)
 
 xbmath::natural& xbmath::natural::mul (const xbmath::natural& n)
 {
-    const_iterator i	 = n.p.begin(),
-	i_end = n.p.end();
-    natural summ;
-    int shift_c = 0;
-    for( ; i != i_end; ++i ) {
-	register atom  b = first_bit;
-	int left_bits = atom_bits;
-	register atom act = *i;
-	do {
-	    if( act & b ) {
-		if( shift_c > 0 )
-		    shift_left(shift_c);
-		summ.add(*this);
-		shift_c = 0;
-	    }
-	    shift_c++;
-	    b = b << 1;
-	    --left_bits;
-	    if( b > act ) {
-		shift_c += left_bits;
-		break;
-	    }
-	} while( b != 0 );
-    }
-    return *this = summ;
+    const container& q = n.p;
+    if( is_zero() || n.is_zero() )
+	return zero();
+    const kernel::size_type k = p.size() + q.size();
+    kernel::scratch r(k);
+    if( p.size() >= q.size() )
+	kernel::mul(r,&p[0],p.size(),&q[0],q.size());
+    else
+	kernel::mul(r,&q[0],q.size(),&p[0],p.size());
+    p.assign(r,r + kernel::normalize(r,k));
+    return *this;
 } // mul
 
 xbmath::natural& xbmath::natural::pow(unsigned long c)
@@ -411,42 +1323,40 @@ xbmath::natural& xbmath::natural::pow(unsigned long c)
 
 xbmath::natural& xbmath::natural::shift_left(int c)
 {
-    while( c >= atom_bits ) {
-	p.insert(p.begin(),0);
-	c-= atom_bits;
-    }
-    if( c > 0 ) {
-	iterator i = p.begin();
-	iterator end = p.end();
-	atom carry = 0;
-	while( i != end ) {
-	    register atom t = *i >> (atom_bits - c);
-	    *i = (*i << c) | carry;
-	    carry = t;
-	    ++i;
-	}
-	if( carry != 0 )
-	    p.insert(p.end(),carry);
-    }
+    if( c <= 0 || is_zero() )
+	return *this;
+    kernel::size_type words = c / atom_bits;
+    unsigned bits = c % atom_bits;
+    kernel::size_type n = p.size();
+    p.resize(n + words + 1);
+    atom* d = &p[0];
+    if( bits )
+	d[n+words] = kernel::lshift(d+words,d,n,bits);
+    else if( words )
+	memmove(d+words,d,n*sizeof(atom));
+    if( words )
+	memset(d,0,words*sizeof(atom));
+    if( d[n+words] == 0 )
+	p.erase(p.end()-1);
     return *this;
 }   /* shift_left */
 
 xbmath::natural& xbmath::natural::shift_right(int c)
 {
-    while( c >= atom_bits ) {
-	p.erase(p.begin());
-	c-= atom_bits;
-    }
-    if( c > 0 ) {
-	iterator i = p.end();
-	iterator begin = p.begin();
-	atom carry = 0;
-	do { --i;
-	register atom t = *i << (atom_bits - c);
-	*i = (*i >> c) | carry;
-	carry = t;
-	} while ( i != begin );
-    }
+    if( c <= 0 || p.size() == 0 )
+	return *this;
+    kernel::size_type words = c / atom_bits;
+    unsigned bits = c % atom_bits;
+    kernel::size_type n = p.size();
+    if( words >= n )
+	return zero();
+    atom* d = &p[0];
+    if( bits )
+	kernel::rshift(d,d+words,n-words,bits);
+    else if( words )
+	memmove(d,d+words,(n-words)*sizeof(atom));
+    if( words )
+	p.erase(p.end()-words,p.end());
     delete_zeroes();
     return *this;
 }   /* shift_right */
@@ -455,34 +1365,93 @@ int xbmath::natural::cmp(const xbmath::natural& n) const
 {
     register const container& q = n.p;
     /* check sizes */
-    {
-	register int d = p.size() - q.size();
-	if( d )
-	    return d;
-    }
-    const_iterator p_i = p.end();
-    const_iterator q_i = q.end();
-    do {
-	--p_i, --q_i;
-	if( *p_i > *q_i )
-	    return 1;
-	if( *p_i < *q_i)
-	    return -1;
-    } while ( p_i != p.begin() );
-    return 0;
+    if( p.size() != q.size() )
+	return p.size() > q.size() ? 1 : -1;
+    if( p.size() == 0 )
+	return 0;
+    return kernel::cmp(&p[0],&q[0],p.size());
 }
 
 void xbmath::natural::delete_zeroes()
 {
-    iterator i = p.end();
-    do {
-	--i;
-	if( *i != 0 )
-	    break;
-    } while (i != p.begin() );
-    ++i;
-    if( i != p.end() )
-	p.erase(i,p.end());
+    if( p.size() > 1 ) {
+	kernel::size_type n = kernel::normalize(&p[0],p.size());
+	if( n == 0 )
+	    n = 1;
+	if( n != p.size() )
+	    p.erase(p.begin()+n,p.end());
+    }
+}
+
+void xbmath::natural::calc_div(
+			       const xbmath::natural& a,
+			       const xbmath::natural& b,
+			       xbmath::natural& div_result,
+			       xbmath::natural& mod_result)
+{
+    divide(a,b,&div_result,&mod_result);
+}
+
+void xbmath::natural::divide(const natural& a,const natural& b,natural* q,natural* r)
+/* calc_div, either result may be left out */
+{
+    if( b.is_zero() ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_division_by_zero);
+#else
+	assert( !b.is_zero() );
+	return;
+#endif
+    }
+    if( a.cmp(b) < 0 ) {
+	if( r )
+	    r->set(a);
+	if( q )
+	    q->zero();
+	return;
+    }
+    // both in scratch before a or b may change
+    const kernel::size_type an = a.p.size();
+    const kernel::size_type bn = b.p.size();
+    kernel::scratch t(an + 1);
+    atom* u = t;
+    atom* v = u + an - bn + 1;
+    kernel::divrem(u,v,&a.p[0],an,&b.p[0],bn);
+    const kernel::size_type un = kernel::normalize(u,an - bn + 1);
+    const kernel::size_type vn = kernel::normalize(v,bn);
+    if( q ) {
+	q->p.assign(u,u + un);
+	if( un == 0 )
+	    q->p.push_back(0);
+    }
+    if( r ) {
+	r->p.assign(v,v + vn);
+	if( vn == 0 )
+	    r->p.push_back(0);
+    }
+}
+
+xbmath::natural& xbmath::natural::divexact(const xbmath::natural& d)
+{
+    if( d.is_zero() ) {
+#ifdef XBM_WITH_EXCEPTIONS
+	throw exception(exception::exc_division_by_zero);
+#else
+	assert( !d.is_zero() );
+	return *this;
+#endif
+    }
+    if( is_zero() )
+	return *this;
+    kernel::size_type an = p.size();
+    kernel::size_type dn = d.p.size();
+    assert( an >= dn );
+    const kernel::size_type k = an - dn + 1;
+    kernel::scratch q(k);
+    kernel::divexact(q,&p[0],an,&d.p[0],dn);
+    const kernel::size_type qn = kernel::normalize(q,k);
+    p.assign(q,q + (qn ? qn : 1));
+    return *this;
 }
 
 void xbmath::integer::calc_div(
@@ -490,59 +1459,12 @@ void xbmath::integer::calc_div(
 			       const xbmath::integer& b,
 			       xbmath::integer& div_result,
 			       xbmath::integer& mod_result)
-// #define OUTPUT_CALC_DIV_STEPS cerr
+// div_result = a / b, mod_result = a % b, signs as in div() and mod()
 {
-    mod_result = a;
-    div_result.zero();
-    if( mod_result < b )
-	return;
-    else {
-	integer current_div = b;
-	integer current_multiplier = 1;
-	int k;
-	while(( k = current_div.cmp(mod_result)) < 0 ) {
-	    current_multiplier.mul2();
-	    current_div.mul2();
-#ifdef OUTPUT_CALC_DIV_STEPS
-	    OUTPUT_CALC_DIV_STEPS
-		<< "1: mod_result="<< mod_result
-		<< " current_mult=" << current_multiplier
-		<< " current_div: " << current_div << endl;
-#endif
-	}
-	do {
-	    while(( k = current_div.cmp(mod_result)) > 0 ) {
-		current_div.div2();
-		current_multiplier.div2();
-#ifdef OUTPUT_CALC_DIV_STEPS
-		OUTPUT_CALC_DIV_STEPS
-		    << "4: current_mult=" << current_multiplier
-		    << " current_div=" << current_div << endl;
-#endif
-	    }
-	    if( k == 0 ) {
-		mod_result = 0;
-		div_result += current_multiplier;
-#ifdef OUTPUT_CALC_DIV_STEPS
-		OUTPUT_CALC_DIV_STEPS
-		    << "6: HIT k=0: mod_result=" << mod_result
-		    << " div_result=" << div_result << endl;
-#endif
-		return;
-	    }
-	    mod_result -= current_div;
-	    div_result += current_multiplier;
-
-	    k = mod_result.cmp(b);
-#ifdef OUTPUT_CALC_DIV_STEPS
-	    OUTPUT_CALC_DIV_STEPS
-		<< "7: mod_result("<< mod_result.p.size() <<")=" << mod_result
-		<< ", b("<< b.p.size() <<")=" << b
-		<< ", mod_result cmp b : " << k
-		<< ", div_result=" << div_result << endl;
-#endif
-	} while( k >= 0 );
-    }
+    bool s = (a.sign == b.sign);
+    natural::calc_div(a,b,div_result,mod_result);
+    div_result.sign = div_result.is_zero() ? true : s;
+    mod_result.sign = mod_result.is_zero() ? true : s;
 }
 
 bool xbmath::integer::calc_GCD1(
@@ -559,7 +1481,7 @@ bool xbmath::integer::calc_GCD1(
 	    a -= b;
 	else	    // b > a
 	    b -= a;
-	result = a;
+	result.swap(a);
 	return ! result.is_one();
 }
 
@@ -568,185 +1490,130 @@ bool xbmath::integer::calc_GCD(
 			       xbmath::integer& result,
 			       const xbmath::integer& A,
 			       const xbmath::integer& B)
-// A more obfuscated implementation of
-// Euklid algorithm
-// Derecursived.
+// Euklid algorithm on the magnitudes in scratch: the two numbers
+// and the remainder rotate through three buffers, so nothing is
+// allocated once result has room. The result is not negative.
 {
-    integer a(A),b(B);
-    while( 1 ) {
-	a.mod(b);
-	if( a.is_zero() ) {
-	    result = b;
-	    return !result.is_one();
-	}
-	b.mod(a);
-	if( b.is_zero() ) {
-	    result = a;
-	    return !result.is_one();
-	}
+    const kernel::size_type m = A.p.size() > B.p.size() ? A.p.size() : B.p.size();
+    kernel::scratch t(4*m);
+    atom* u = t;
+    atom* v = u + m;
+    atom* w = v + m;
+    atom* q = w + m;
+    kernel::size_type un = kernel::normalize(&A.p[0],A.p.size());
+    kernel::size_type vn = kernel::normalize(&B.p[0],B.p.size());
+    memcpy(u,&A.p[0],un*sizeof(atom));
+    memcpy(v,&B.p[0],vn*sizeof(atom));
+    if( un < vn || (un == vn && un && kernel::cmp(u,v,un) < 0) ) {
+	atom* x = u; u = v; v = x;
+	kernel::size_type k = un; un = vn; vn = k;
     }
+    while( vn ) {
+	kernel::divrem(q,w,u,un,v,vn);
+	const kernel::size_type wn = kernel::normalize(w,vn);
+	atom* x = u;
+	u = v;
+	un = vn;
+	v = w;
+	vn = wn;
+	w = x;
+    }
+    result.p.assign(u,u + un);
+    if( un == 0 )
+	result.p.push_back(0);
+    result.sign = true;
+    return !result.is_one();
 }
 
 xbmath::integer& xbmath::integer::dec_nc()
 {
-    iterator i = p.begin();
-    bool cf = false;
-    if( p.size() == 0 ) {
-	p.insert(p.end(),1);
-	sign = !sign;
-	return *this;
-    }
-    do {
-	if( *i > 0 ) {
-	    --(*i);
-	    cf = false;
-	    break;
-	} else
-	    cf = true;
-	--(*i);
-    } while( ++i != p.end() );
-    if( cf ) {
+    if( is_zero() ) {
+	natural::one();
 	sign = false;
-	*(p.end()-1) = ~*(p.end()-1) + 1;
+	return *this;
     }
+    kernel::sub_1(&p[0],&p[0],p.size(),1);
     delete_zeroes();
     if( is_zero() )
 	sign = true;
-
     return *this;
 }
 
 xbmath::integer& xbmath::integer::sub_nc (const xbmath::integer& x)
 {
-    const container& q = x.p;
-    iterator i = p.begin(),
-	p_end = p.end();
-    const_iterator j = q.begin(),
-	q_end = q.end();
-    bool cf = false;
-    unsigned int len = p.size() < q.size() ? p.size() : q.size();
-    for( unsigned int k = 0; k < len ; ++k,++i,++j ) {
-	register atom t = *i - *j;
-	if( cf ) {
-	    cf = (*i <= *j );
-	    --t;
-#ifdef OUTPUT_SUB_STEPS
-	    OUTPUT_SUB_STEPS << "1: sub: " << *i << " - " << *j << " - " << 1
-		<< " = " << t << " ,cf=" << cf << endl;
-#endif
-	} else {
-	    cf = ( t > *i );
-#ifdef OUTPUT_SUB_STEPS
-	    OUTPUT_SUB_STEPS << "1: sub: " << *i << " - " << *j
-		<< " = " << t << " ,cf=" << cf << endl;
-#endif
-	}
-	*i = t;
-    }
-    if( cf && i != p_end ) {
-	do {
-	    if( *i > 0 ) {
-		--(*i);
-		cf = 0;
-		break;
-	    } else
-		cf = true;
-	    --(*i);
-	} while( ++i != p_end );
-    } else if( j != q_end ) { do {
-	/* append -*q */
-	register atom t = *j + cf;
-	cf = (t == 0);
-	p.insert(p.end(),-t);
-    } while( ++j != q_end );
-    cf = true;
-    }
-
-    if( cf ) {
+    return sub_atoms(&x.p[0],x.p.size());
+}
+
+xbmath::integer& xbmath::integer::sub_atoms(const atom* b,kernel::size_type bn)
+{
+    if( bn == 0 )
+	return *this;
+    const kernel::size_type an = p.size();
+    if( an != bn ? an > bn : kernel::cmp(&p[0],b,bn) >= 0 )
+	kernel::sub(&p[0],&p[0],an,b,bn);
+    else {
+	// |x| > |this|: result is -(|x| - |this|)
+	p.resize(bn);
+	kernel::sub(&p[0],b,bn,&p[0],an);
 	sign = false;
-	*(p.end()-1) = ~*(p.end()-1) + 1;
     }
-    /*
-    sign = !cf;
-    if( !sign )
-	*(p.end()-1) = ~*(p.end()-1) + 1;
-    */
     delete_zeroes();
     if( is_zero() )
 	sign = true;
     return *this;
 }
 
-xbmath::integer& xbmath::integer::div_nc(const xbmath::integer& b)
+xbmath::integer& xbmath::integer::add_signed(const atom* b,kernel::size_type bn,bool s)
+/* as add(), b the magnitude and s the sign of the other */
 {
-    if( cmp(b) < 0 ) {
-	zero();
-	return *this;
-    }
-    if( p.size() == 1 && b.p.size() == 1 ) {
-	*p.begin() /= *b.p.begin();
-	return *this;
-    }
-    integer div_result;
-    integer current_div = b;
-    integer current_multiplier = 1;
-    int k;
-    while(( k = current_div.cmp(*this)) < 0 ) {
-	current_multiplier.mul2();
-	current_div.mul2();
-    }
-    if( k == 0 ) {
-	set(current_multiplier);
-	return *this;
+    if( sign == s )
+	natural::add_atoms(b,bn);
+    else if( sign )
+	sub_atoms(b,bn);
+    else {
+	sign = true;
+	sub_atoms(b,bn);
+	sign = !sign;
     }
-    do {
-	while(( k = current_div.cmp(*this)) > 0 ) {
-	    current_div.div2();
-	    current_multiplier.div2();
-	}
-	if( k == 0 ) {
-	    set(div_result);
-	    add(current_multiplier);
-	    return *this;
-	}
-	sub_nc(current_div);
-	div_result.add_nc(current_multiplier);
-	k = cmp(b);
-    } while( k >= 0 );
-    set(div_result);
+    if( is_zero() )
+	sign = true;
     return *this;
 }
 
-xbmath::integer& xbmath::integer::mod_nc(const xbmath::integer& b)
+xbmath::integer& xbmath::integer::addmul(const integer& a,const integer& b)
 {
-    if( cmp(b) < 0 )
-	return *this;
-    if( p.size() == 1 && b.p.size() == 1 ) {
-	*p.begin() = *p.begin() % *b.p.begin();
-	return *this;
-    }
-    integer current_div = b;
-    integer current_multiplier = 1;
-    int k;
-    while( (k = cmp(current_div)) > 0 ) {
-	current_div.mul2();
-    }
-    if( k ==0 ) {
-	zero();
-	return *this;
-    }
-    do {
-	while(( k = current_div.cmp(*this)) > 0 ) {
-	    current_div.div2();
-	}
-	if( k == 0 ) {
-	    zero();
-	    return *this;
-	}
-	sub_nc(current_div);
+    // the product in scratch, so a or b may be this
+    const kernel::size_type an = a.p.size();
+    const kernel::size_type bn = b.p.size();
+    kernel::scratch t(an + bn);
+    if( an >= bn )
+	kernel::mul(t,&a.p[0],an,&b.p[0],bn);
+    else
+	kernel::mul(t,&b.p[0],bn,&a.p[0],an);
+    return add_signed(t,kernel::normalize(t,an + bn),a.sign == b.sign);
+}
+
+xbmath::integer& xbmath::integer::submul(const integer& a,const integer& b)
+{
+    const kernel::size_type an = a.p.size();
+    const kernel::size_type bn = b.p.size();
+    kernel::scratch t(an + bn);
+    if( an >= bn )
+	kernel::mul(t,&a.p[0],an,&b.p[0],bn);
+    else
+	kernel::mul(t,&b.p[0],bn,&a.p[0],an);
+    return add_signed(t,kernel::normalize(t,an + bn),a.sign != b.sign);
+}
 
-	k = cmp(b);
-    } while( k >= 0 );
+xbmath::integer& xbmath::integer::div_nc(const xbmath::integer& b)
+{
+    natural::divide(*this,b,this,NULL);
+    return *this;
+}
+
+xbmath::integer& xbmath::integer::mod_nc(const xbmath::integer& b)
+{
+    natural::divide(*this,b,NULL,this);
     return *this;
 }
 
@@ -817,3 +1684,51 @@ char*	xbmath::rational::str_dec(char* buf,int max,int prec) const
     return buf;
 }
 
+void	xbmath::rational::to_str(kernel::str_writer& w,int prec) const
+{
+    if( prec < 0 )
+	prec = 0;
+    // |p| * 10^prec / q, written as whole part and prec digits
+    integer x = p;
+    x.mul10(prec);
+    x.abs();
+    x.div(q);
+    if( !positive() && !x.is_zero() )
+	w.write("-",1);
+    if( prec == 0 ) {
+	x.natural::to_str(w,10);
+	return;
+    }
+    natural f;
+    f.one();
+    f.mul10(prec);
+    natural::calc_div(x,f,x,f);
+    x.natural::to_str(w,10);
+    w.write(".",1);
+    f.to_str(w,10,prec);
+}
+
+size_t	xbmath::rational::bin_length() const
+{
+    return p.bin_length() + q.bin_length();
+}
+
+size_t	xbmath::rational::to_bin(void* buf,size_t max) const
+{
+    size_t n = p.to_bin(buf,max);
+    size_t m = n ? q.to_bin((unsigned char*)buf + n,max - n) : 0;
+    return m ? n + m : 0;
+}
+
+size_t	xbmath::rational::set_bin(const void* buf,size_t len)
+{
+    integer a;
+    integer b;
+    size_t n = a.set_bin(buf,len);
+    size_t m = n ? b.set_bin((const unsigned char*)buf + n,len - n) : 0;
+    if( m == 0 || b.is_zero() )	// q may be negative, as after div
+	return 0;
+    p.swap(a);
+    q.swap(b);
+    return n + m;
+}
@@ -39,7 +39,7 @@
     These defines may apear before including header:
     
     #define XBM_NO_IOSTREAM 
-	if you don't want output operators for ostream
+	if you don't want operators for iostreams
 
     #define XBM_NEED_NAMESPACE or
     #define XBM_WITH_NAMESPACE 
@@ -54,6 +54,9 @@
 	    ::vector 
 	instead of namespace std:
 	    std::vector
+
+    #define XBM_INLINE_LIMBS n
+	atoms a number keeps without heap allocation (default 4)
     
 * Copyright
 
@@ -99,6 +102,9 @@ USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <vector>
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -110,6 +116,30 @@ USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define XBM_NEED_NAMESPACE
 #define XBM_WITH_EXCEPTIONS
 
+#ifndef XBM_INLINE_LIMBS
+#define XBM_INLINE_LIMBS 4
+#endif
+
+/* With C++11 numbers have move constructors and assignment, and
+   the arithmetic operators reuse a temporary left operand. */
+#if __cplusplus >= 201103L || (defined _MSC_VER && _MSC_VER >= 1900)
+#   define XBM_HAVE_MOVE
+#   define XBM_LVALUE_THIS	&
+#   include <utility>
+#else
+#   define XBM_LVALUE_THIS
+#endif
+
+#if __cplusplus >= 201103L
+#   define XBM_THREAD_LOCAL thread_local
+#elif defined _MSC_VER
+#   define XBM_THREAD_LOCAL __declspec(thread)
+#elif defined __GNUC__
+#   define XBM_THREAD_LOCAL __thread
+#else
+#   define XBM_THREAD_LOCAL
+#endif
+
 #if defined(XBM_NEED_NAMESPACE) || defined(XBM_WITH_NAMESPACE)
 namespace xbmath {
 #else
@@ -142,12 +172,31 @@ public:
 
 /* Force default atom to usigned long. */
 #ifndef _XBM_ATOM_LEN
+#if	ULONG_MAX > 0xffffffffUL
+#   define _XBM_ATOM_LEN	64
+#   define UI64(x)  x ## ul
+#else
 #   define _XBM_ATOM_LEN	32
+#endif
 #   define _XBM_ATOM_FMT_DEC_	"lu"
 #   define _XBM_ATOM_FMT_HEX_	"lx"
     typedef unsigned long	atom;
     typedef signed long 	signed_atom;
 #endif
+
+/* Double width atom, used for atom by atom products. */
+#if	_XBM_ATOM_LEN == 64
+#if	defined __SIZEOF_INT128__
+    typedef unsigned __int128	double_atom;
+#   define XBM_HAVE_DOUBLE_ATOM
+#endif
+#elif	defined  _MSC_VER || defined __BORLANDC__
+    typedef unsigned __int64	double_atom;
+#   define XBM_HAVE_DOUBLE_ATOM
+#else
+    typedef unsigned long long	double_atom;
+#   define XBM_HAVE_DOUBLE_ATOM
+#endif
 /* Format specifier for output atom. */
 #define XBM_ATOM_FMT_DEC    "%" _XBM_ATOM_FMT_DEC_
 #define XBM_ATOM_FMT_HEX    "%" _XBM_ATOM_FMT_HEX_
@@ -170,15 +219,325 @@ public:
     enum constants {
 	atom_bits = sizeof( atom ) * 8,
 	first_bit = 1,
-	last_bit  = first_bit << (atom_bits-1)
+	last_bit  = ((atom)first_bit) << (atom_bits-1)
     };
 
-#ifndef NO_STD_NAMESPACE
-    typedef std::vector<atom>	container;
-#else
-    typedef vector<atom>	container;
+    /*
+	Where heap limbs come from: malloc, unless the thread has set a
+	memory_resource, e.g. with a memory_scope. Limbs remember their
+	resource and give their storage back to it, so it must outlive
+	them; arena and pool serve one thread at a time, so each thread
+	would have its own and there is no lock to contend on.
+    */
+    class memory_resource {
+    public:
+	/* NULL when out of memory */
+	virtual void*	allocate(size_t bytes) = 0;
+	virtual void	deallocate(void* p,size_t bytes) = 0;
+	virtual ~memory_resource() {}
+
+	/* The calling thread's resource, NULL for malloc; set_current
+	   returns the previous one. */
+	static memory_resource* current();			// xbmath.cpp
+	static memory_resource* set_current(memory_resource* r); // xbmath.cpp
+    };
+
+    /* The thread's resource while it exists. */
+    class memory_scope {
+    public:
+	memory_scope(memory_resource* r) : prev(memory_resource::set_current(r)) {}
+	~memory_scope() { memory_resource::set_current(prev); }
+    private:
+	memory_scope(const memory_scope&);
+	void operator = (const memory_scope&);
+	memory_resource* prev;
+    };
+
+    /* Bump allocation from blocks of at least block_bytes. Storage
+       given back is reused only when it was the last allocated; all
+       of it goes at once with release() or the destructor, when no
+       number may use it any more. */
+    class arena : public memory_resource {
+    public:
+	arena(size_t block_bytes = 65536)
+	    : head(0), top(0), end(0), block_bytes(block_bytes) {}
+	~arena() { release(); }
+	void*	allocate(size_t bytes);			// xbmath.cpp
+	void	deallocate(void* p,size_t bytes);	// xbmath.cpp
+	void	release();				// xbmath.cpp
+    private:
+	arena(const arena&);
+	void operator = (const arena&);
+	struct block;
+	block*	head;
+	char*	top;
+	char*	end;
+	size_t	block_bytes;
+    };
+
+    /* Free lists of power of two sizes from 32 bytes to 1 MB, larger
+       sizes straight from malloc. Storage given back is kept for the
+       next allocation of its size until the pool goes. */
+    class pool : public memory_resource {
+    public:
+	pool();						// xbmath.cpp
+	~pool();					// xbmath.cpp
+	void*	allocate(size_t bytes);			// xbmath.cpp
+	void	deallocate(void* p,size_t bytes);	// xbmath.cpp
+    private:
+	pool(const pool&);
+	void operator = (const pool&);
+	enum { min_shift = 5, classes = 16 };
+	struct node { node* next; };
+	node*	free_list[classes];
+    };
+
+    /* Blocks with a reference count: while limbs come from here their
+       copies share them instead of copying, and a shared block is
+       cloned before the first write through any of its holders. The
+       count is atomic, the blocks come from malloc, so copies may go
+       to other threads and outlive the scope that made them. */
+    class shared_limbs : public memory_resource {
+    public:
+	void*	allocate(size_t bytes);			// xbmath.cpp
+	/* drops a reference, the last one frees the block */
+	void	deallocate(void* p,size_t bytes);	// xbmath.cpp
+	static void*	hold(void* p);			// xbmath.cpp
+	static bool	sole(const void* p);		// xbmath.cpp
+
+	static shared_limbs resource;			// xbmath.cpp
+    };
+
+    /*
+	Limbs of a number: a growable array of atoms with the parts of
+	std::vector<atom> the library uses. Up to XBM_INLINE_LIMBS of
+	them live in the object itself, more on the heap, or in a
+	memory mapped file:
+
+	    private map	    a file mapped copy on write, loaded without
+			    reading it; changes never reach the file
+			    and growing moves the limbs to the heap
+	    shared map	    the limbs are the file, read-write; growing
+			    grows the file. Such limbs stay with their
+			    object: swap and assignment move values, not
+			    the storage.
+
+	Heap limbs from shared_limbs::resource are shared by copies
+	until written, the writer gets its own; non-const access counts
+	as a write.
+
+	See natural::map_bin and natural::map_file.
+    */
+    class limbs {
+    public:
+	typedef atom		value_type;
+	typedef atom*		iterator;
+	typedef const atom*	const_iterator;
+	typedef atom&		reference;
+	typedef const atom&	const_reference;
+	typedef size_t		size_type;
+	typedef ptrdiff_t	difference_type;
+
+	limbs() : d(in), n(0), cap(inline_limbs), m(0), r(0) {}
+	explicit limbs(size_type c,atom v = 0) : d(in), n(0), cap(inline_limbs), m(0), r(0) {
+	    assign(c,v);
+	}
+	limbs(const atom* first,const atom* last) : d(in), n(0), cap(inline_limbs), m(0), r(0) {
+	    assign(first,last);
+	}
+	limbs(const limbs& o) : d(in), n(0), cap(inline_limbs), m(0), r(0) {
+	    if( o.r == &shared_limbs::resource )
+		share(o);
+	    else
+		assign(o.d,o.d + o.n);
+	}
+	/* container used to be std::vector<atom> */
+	limbs(const std::vector<atom>& v) : d(in), n(0), cap(inline_limbs), m(0), r(0) {
+	    if( !v.empty() )
+		assign(&v[0],&v[0] + v.size());
+	}
+	~limbs() {
+	    if( m )
+		release();
+	    else if( d != in )
+		heap_free();
+	}
+	limbs& operator = (const limbs& o) {
+	    if( this == &o )
+		return *this;
+	    if( o.r == &shared_limbs::resource && m == 0 )
+		share(o);	// a shared map keeps its storage
+	    else
+		assign(o.d,o.d + o.n);
+	    return *this;
+	}
+#ifdef XBM_HAVE_MOVE
+	/* Takes the storage, except from a shared map: that stays
+	   with its object and only the values are copied. */
+	limbs(limbs&& o) : d(in), n(0), cap(inline_limbs), m(0), r(0) {
+	    if( o.m && o.shared() )
+		assign(o.d,o.d + o.n);
+	    else
+		swap(o);
+	}
+	limbs& operator = (limbs&& o) {
+	    if( (m || o.m) && (shared() || o.shared()) )
+		assign(o.d,o.d + o.n);
+	    else
+		swap(o);
+	    return *this;
+	}
 #endif
 
+	size_type	size() const { return n; }
+	size_type	capacity() const { return cap; }
+	bool		empty() const { return n == 0; }
+
+	atom*		data() { own(); return d; }
+	const atom*	data() const { return d; }
+	iterator	begin() { own(); return d; }
+	iterator	end() { own(); return d + n; }
+	const_iterator	begin() const { return d; }
+	const_iterator	end() const { return d + n; }
+	atom&		operator [] (size_type i) { own(); return d[i]; }
+	const atom&	operator [] (size_type i) const { return d[i]; }
+	atom&		front() { own(); return d[0]; }
+	const atom&	front() const { return d[0]; }
+	atom&		back() { own(); return d[n-1]; }
+	const atom&	back() const { return d[n-1]; }
+
+	void	reserve(size_type c) {
+	    if( c > cap )
+		grow(c);
+	}
+	void	resize(size_type c,atom v = 0) {
+	    own();
+	    if( c > cap )
+		grow(c);
+	    for( size_type i = n; i < c; ++i )
+		d[i] = v;
+	    n = c;
+	}
+	void	clear() { n = 0; }
+	void	push_back(atom v) {
+	    own();
+	    if( n == cap )
+		grow(n + 1);
+	    d[n++] = v;
+	}
+	void	pop_back() { --n; }
+
+	void	assign(size_type c,atom v) {
+	    n = 0;
+	    resize(c,v);
+	}
+	void	assign(const atom* first,const atom* last) {
+	    size_type c = last - first;
+	    own(false);
+	    if( c > cap )
+		grow(c,true);
+	    if( c )
+		memmove(d,first,c*sizeof(atom));
+	    n = c;
+	}
+
+	iterator insert(iterator pos,atom v) {
+	    return insert(pos,1,v);
+	}
+	iterator insert(iterator pos,size_type c,atom v) {
+	    size_type i = open(pos,c);
+	    for( size_type j = 0; j < c; ++j )
+		d[i+j] = v;
+	    return d + i;
+	}
+	iterator insert(iterator pos,const atom* first,const atom* last) {
+	    limbs t(first,last);	// the range may be in this
+	    size_type i = open(pos,t.n);
+	    if( t.n )
+		memcpy(d + i,t.d,t.n*sizeof(atom));
+	    return d + i;
+	}
+	iterator erase(iterator pos) {
+	    return erase(pos,pos + 1);
+	}
+	iterator erase(iterator first,iterator last) {
+	    // first and last come from begin(), which made them ours
+	    memmove(first,last,(end() - last)*sizeof(atom));
+	    n -= last - first;
+	    return first;
+	}
+
+	void	swap(limbs& o) {
+	    if( d == in || o.d == o.in || ((m || o.m) && (shared() || o.shared())) )
+		swap_values(o);
+	    else {
+		atom* t = d; d = o.d; o.d = t;
+		size_type c = n; n = o.n; o.n = c;
+		c = cap; cap = o.cap; o.cap = c;
+		mapping* q = m; m = o.m; o.m = q;
+		memory_resource* a = r; r = o.r; o.r = a;
+	    }
+	}
+
+	/* Memory mapped storage, see above; false when the file is
+	   not a native binary record (see natural::to_bin) or cannot
+	   be mapped. map_shared with create makes the file and puts
+	   the current limbs in it, else takes the limbs of the record
+	   in it, which must not be negative; unmap moves them to the
+	   heap. */
+	bool	map_private(const char* path,bool* negative = 0); // xbmath.cpp
+	bool	map_shared(const char* path,bool create);	// xbmath.cpp
+	void	unmap();				// xbmath.cpp
+	bool	mapped() const { return m != 0; }
+	bool	shared() const;				// xbmath.cpp
+	/* Shared map: record header up to date on disk. */
+	bool	sync();					// xbmath.cpp
+
+    private:
+	struct mapping;
+
+	size_type open(iterator pos,size_type c) {
+	    size_type i = pos - d;
+	    own();
+	    if( n + c > cap )
+		grow(n + c);
+	    memmove(d + i + c,d + i,(n - i)*sizeof(atom));
+	    n += c;
+	    return i;
+	}
+	void	grow(size_type c,bool discard = false);	// xbmath.cpp
+	void	relocate(size_type c,bool keep);	// xbmath.cpp
+	void	release();				// xbmath.cpp
+	void	share(const limbs& o);			// xbmath.cpp
+	void	unshare(bool keep);			// xbmath.cpp
+	/* before a write: a shared block is cloned, or just left
+	   without keep when the values are replaced */
+	void	own(bool keep = true) {
+	    if( r == &shared_limbs::resource )
+		unshare(keep);
+	}
+	void	swap_values(limbs& o);			// xbmath.cpp
+	void	heap_free() {
+	    if( r )
+		r->deallocate(d,cap*sizeof(atom));
+	    else
+		free(d);
+	}
+
+	enum { inline_limbs = XBM_INLINE_LIMBS };
+
+	atom*	    d;		// in, the heap or a map
+	size_type   n;
+	size_type   cap;
+	mapping*    m;
+	memory_resource* r;	// of heap limbs, NULL for malloc
+	atom	    in[inline_limbs];
+    };
+
+    inline void swap(limbs& a,limbs& b) { a.swap(b); }
+
+    typedef limbs	container;
+
     typedef container::iterator iterator;
     typedef container::const_iterator const_iterator;
 
@@ -240,6 +599,198 @@ public:
 			a.insert(a.end(),1);
 		}
 	    }; // template <atom base> class dec_add
+
+    class kernel {
+	/* class kernel description
+	    Low level routines working on raw atom arrays, least
+	    significant atom first. Sizes are counted in atoms.
+	    Result may be the same array as the (first) source, unless
+	    noted otherwise. Implementation in xbkernel.cpp.
+
+		add_1	r = a + b		returns carry
+		add_n	r = a + b (n atoms)	returns carry
+		add	r = a + b (an >= bn)	returns carry
+		sub_1	r = a - b		returns borrow
+		sub_n	r = a - b (n atoms)	returns borrow
+		sub	r = a - b (an >= bn)	returns borrow
+		mul_1	r = a * b		returns high atom
+		addmul_1 r += a * b		returns high atom
+		submul_1 r -= a * b		returns high atom (borrow)
+		lshift	r = a << c (0<c<atom_bits) returns bits shifted out,
+			r may be above a (processed from the top)
+		rshift	r = a >> c (0<c<atom_bits) returns bits shifted out
+			(in the high end of atom), r may be below a
+		mul_basecase r = a * b (an >= bn >= 1), schoolbook
+		mul	r = a * b (an >= bn >= 1), r has an+bn atoms
+			and must not overlap a nor b; selects
+			schoolbook, Karatsuba, Toom-3, Toom-4 or NTT
+			by size of b, using thresholds below;
+			a == b (same array and size) goes to sqr
+		sqr_basecase r = a * a, schoolbook using symmetry
+		sqr	r = a * a, r has 2n atoms and must not
+			overlap a; squaring variants of mul
+		divrem_1 q = a / d, returns a % d; q may be a;
+			d may be given as inverse_1
+		mod_1	returns a % d, d given as inverse_1
+		divrem	q = a / d, r = a % d (an >= dn >= 1,
+			d[dn-1] != 0); Knuth algorithm D,
+			Burnikel-Ziegler, or Newton inverse for
+			large d and a quotient several times
+			longer than d;
+			q has an-dn+1 atoms, r has dn atoms,
+			neither may overlap a nor d
+		to_str	digits of a in base 2..36 to s (lower case,
+			no terminating NUL), returns their count;
+			s must hold str_digits_max(a,n,base)
+			characters; or in pieces to a str_writer,
+			zero padded to width digits
+		str_digits_max digits of a in base, exact or one
+			more (exact for powers of two)
+		from_str r = value of len digits s in base (only
+			valid digits, either case), returns atoms
+			of r; r must hold str_atoms_max(len,base)
+			atoms
+		str_reader digits given in pieces, most significant
+			first, to a number; each full block is
+			converted as it arrives and merged with
+			earlier ones of the same size, so the text
+			is never held whole
+		bit_length number of significant bits of a
+		divexact q = a / d when d is known to divide a,
+			Hensel division from the low atoms;
+			q has an-dn+1 atoms and must not overlap
+			a nor d
+		cmp	compare n atoms
+		normalize   size without leading zero atoms
+	*/
+    public:
+	typedef size_t size_type;
+
+	/* Multiplication thresholds, in atoms of the shorter operand.
+	   May be tuned at run time. */
+	static size_type karatsuba_threshold;
+	static size_type toom3_threshold;
+	static size_type toom4_threshold;
+	static size_type fft_threshold;
+	static size_type sqr_karatsuba_threshold;
+	static size_type sqr_toom3_threshold;
+	static size_type sqr_toom4_threshold;
+	static size_type sqr_fft_threshold;
+	/* Division thresholds, in atoms of the divisor. */
+	static size_type div_bz_threshold;
+	static size_type div_newton_threshold;
+	/* Exact division threshold, in atoms of the quotient. */
+	static size_type divexact_threshold;
+	/* Divide and conquer radix conversion threshold, in atoms. */
+	static size_type str_dc_threshold;
+
+	static atom add_1(atom* r,const atom* a,size_type n,atom b);
+	static atom add_n(atom* r,const atom* a,const atom* b,size_type n);
+	static atom add(atom* r,const atom* a,size_type an,const atom* b,size_type bn);
+	static atom sub_1(atom* r,const atom* a,size_type n,atom b);
+	static atom sub_n(atom* r,const atom* a,const atom* b,size_type n);
+	static atom sub(atom* r,const atom* a,size_type an,const atom* b,size_type bn);
+
+	static atom mul_1(atom* r,const atom* a,size_type n,atom b);
+	static atom addmul_1(atom* r,const atom* a,size_type n,atom b);
+	static atom submul_1(atom* r,const atom* a,size_type n,atom b);
+
+	static void mul_basecase(atom* r,const atom* a,size_type an,const atom* b,size_type bn);
+	static void mul(atom* r,const atom* a,size_type an,const atom* b,size_type bn);
+	static void sqr_basecase(atom* r,const atom* a,size_type n);
+	static void sqr(atom* r,const atom* a,size_type n);
+
+	/* Atom divisor with precomputed inverse (Moller-Granlund), for
+	   dividing many numbers by the same atom without a hardware
+	   division per atom. */
+	struct inverse_1 {
+	    atom d;		// divisor
+	    atom norm;		// d << shift, top bit set
+	    atom inv;		// floor((B^2-1)/norm) - B
+	    unsigned shift;
+	    inverse_1(atom d = 1);
+	};
+
+	static atom divrem_1(atom* q,const atom* a,size_type n,atom d);
+	static atom divrem_1(atom* q,const atom* a,size_type n,const inverse_1& d);
+	static atom mod_1(const atom* a,size_type n,const inverse_1& d);
+	static void divrem(atom* q,atom* r,const atom* a,size_type an,const atom* d,size_type dn);
+	static void divexact(atom* q,const atom* a,size_type an,const atom* d,size_type dn);
+
+	/* Room for n temporary atoms, taken from a stack the calling
+	   thread keeps between calls, so at steady state temporaries
+	   allocate nothing. Scopes must end in reverse order, as
+	   locals do. reserve makes room for n atoms up front, release
+	   frees the thread's stack. */
+	class scratch {
+	public:
+	    scratch(size_type n);			// xbkernel.cpp
+	    ~scratch();					// xbkernel.cpp
+	    operator atom* () { return p; }
+	    static void reserve(size_type n);		// xbkernel.cpp
+	    static void release();			// xbkernel.cpp
+	    struct chunk;
+	private:
+	    scratch(const scratch&);
+	    void operator = (const scratch&);
+	    atom*   p;
+	    chunk*  c;		// holding p
+	    chunk*  top;	// the thread's top chunk before
+	    size_type used;	// of c before
+	};
+
+	/* Receives the digits of to_str in pieces, most significant
+	   first, so huge numbers need no buffer for all their text. */
+	struct str_writer {
+	    virtual void write(const char* s,size_type len) = 0;
+	    virtual ~str_writer() {}
+	};
+
+	static size_type to_str(char* s,const atom* a,size_type n,int base);
+	static size_type to_str(str_writer& w,const atom* a,size_type n,int base,size_type width = 0);
+	static size_type str_digits_max(const atom* a,size_type n,int base);
+	/* Exact digit count, the first len digits and the last len
+	   (zero padded) from the top atoms and a remainder, without
+	   converting the whole number; all digits if there are fewer.
+	   log2 is estimated from the top atom, -HUGE_VAL for zero. */
+	static size_type str_digits(const atom* a,size_type n,int base);
+	static size_type str_leading(char* s,const atom* a,size_type n,size_type len,int base);
+	static size_type str_trailing(char* s,const atom* a,size_type n,size_type len,int base);
+	static double log2(const atom* a,size_type n);
+	static size_type from_str(atom* r,const char* s,size_type len,int base);
+	static size_type str_atoms_max(size_type len,int base);
+
+	class str_reader {
+	public:
+	    str_reader(int base = 10);
+	    /* only digits of the base, either case */
+	    void put(const char* s,size_type len);
+	    /* digits put so far */
+	    size_type digits() const { return count; }
+	    /* their value, at least one atom; starts over */
+	    void get(container& r);
+	private:
+	    void flush();
+	    int base;
+	    std::vector<char> block;
+	    size_type fill;
+	    size_type count;
+	    std::vector<container> values;	// merged blocks
+	    std::vector<size_type> sizes;	// their digits
+	};
+	static size_type bit_length(const atom* a,size_type n);
+
+	static atom lshift(atom* r,const atom* a,size_type n,unsigned c);
+	static atom rshift(atom* r,const atom* a,size_type n,unsigned c);
+
+	static int  cmp(const atom* a,const atom* b,size_type n);
+	static size_type normalize(const atom* a,size_type n) {
+	    while( n > 0 && a[n-1] == 0 )
+		--n;
+	    return n;
+	}
+    }; // class kernel
+
     class natural;
 	/* class natural description
 	    1. constructors
@@ -250,6 +801,13 @@ public:
 
 	    2. set
 		natural&    set (const char*)
+		natural&    set_str (const char*,int base = 10)
+		bool	    read_file (FILE*,int base = 10)
+		bool	    read_fd (int fd,int base = 10)
+		istream&    read (istream&,int base = 10)
+		size_t	    set_bin (const void* buf,size_t len)
+		bool	    map_bin (const char* path)
+		bool	    map_file (const char* path,bool create = true)
 		natural&    set (const natural&)
 		natural&    set (atom)
 
@@ -270,6 +828,9 @@ public:
 		natural&    mul (const natural&)
 
 		natural&    pow (unsigned long exp = 2)
+		natural&    pow (unsigned long exp,const checkpoint&)
+		natural&    factorial (atom f = 1)
+		natural&    factorial (atom f,const checkpoint&)
 		natural&    sqr (unsigned long exp = 1)
 
 		natural&    shift_left(unsigned long shift_count = 1)
@@ -279,12 +840,31 @@ public:
 		natural&    mul2(int exponent = 1)
 		matural&    div2(int exponent = 1)
 
+		atom	    div_1(atom)
+		atom	    div_1(const kernel::inverse_1&)
+		atom	    mod_1(atom)
+		atom	    mod_1(const kernel::inverse_1&)
+
+		natural&    divexact(const natural&)
+
+	static	void	    calc_div(a,b,div_result,mod_result)
+
 	    5.	output
+			    to_str	(const char* buf,int max,int base = 10)
 			    str_dec	(const char* buf,int max)
 			    str_hex	(const char* buf,int max)
 
+		int	    str_length(int base = 10)
+		size_t	    to_bin	(void* buf,size_t max)
+		size_t	    bin_length()
 		int	    str_dec_length()
 		int	    str_hex_length()
+		int	    str_digits(int base = 10)
+		int	    dec_digits()
+		double	    log2()
+		double	    log10()
+		int	    leading_digits(char* buf,int len,int base = 10)
+		int	    trailing_digits(char* buf,int len,int base = 10)
     */
     class integer;  // +/- natural
 	/* INTERFACE description
@@ -297,6 +877,13 @@ public:
 
 	    2. set
 		integer&    set (const char*)
+		integer&    set_str (const char*,int base = 10)
+		bool	    read_file (FILE*,int base = 10)
+		bool	    read_fd (int fd,int base = 10)
+		istream&    read (istream&,int base = 10)
+		size_t	    set_bin (const void* buf,size_t len)
+		bool	    map_bin (const char* path)
+		bool	    map_file (const char* path,bool create = true)
 		integer&    set (const integer&)
 		integer&    set (atom)
 
@@ -324,13 +911,16 @@ public:
 	TODO!	integer&    mul (atom)
 		integer&    mul (const integer&)
 
-	TODO!	integer&    div (atom)
+		integer&    div (atom)
 		integer&    div (const integer&)
 
-	TODO!	integer&    mod (atom)
+		integer&    mod (atom)
 		integer&    mod (const integer&)
 
+		integer&    divexact (const integer&)
+
 		integer&    pow (unsigned long exp = 2)
+		integer&    pow (unsigned long exp,const checkpoint&)
 		integer&    sqr (unsigned long exp = 1)
 
 		integer&    shift_left(unsigned long shift_count = 1)
@@ -341,9 +931,13 @@ public:
 		matural&    div2(int exponent = 1)
 
 	    5.	output
+			    to_str	(const char* buf,int max,int base = 10)
 			    str_dec	(const char* buf,int max)
 			    str_hex	(const char* buf,int max)
 
+		int	    str_length(int base = 10)
+		size_t	    to_bin	(void* buf,size_t max)
+		size_t	    bin_length()
 		int	    str_dec_length()
 		int	    str_hex_length()
     */
@@ -417,6 +1011,8 @@ public:
 	enum exc_code_e {
 	    exc_unknown,
 	    exc_division_by_zero,
+	    exc_invalid_base,
+	    exc_checkpoint,
 	};
     private:
 
@@ -432,6 +1028,22 @@ public:
     };
 #endif
 
+    /*
+	Checkpointing of long computations (natural::factorial and
+	natural::pow): their state is saved to path every interval
+	seconds, and a later call with the same arguments resumes from
+	it; a file of another computation or with a state out of range
+	is ignored. The file is replaced atomically on each save and
+	removed when the computation ends. A save that fails throws
+	exc_checkpoint and leaves the number as it was.
+    */
+    struct checkpoint {
+	string	    path;
+	unsigned    interval;	// seconds
+	checkpoint(const string& path,unsigned interval = 600)
+	    : path(path), interval(interval) {}
+    };
+
     class natural {
     friend class integer;
     friend class rational;
@@ -451,6 +1063,12 @@ public:
 	{  }
 	natural(const container& c) : p(c)
 	{  }
+#ifdef XBM_HAVE_MOVE
+	natural(natural&& n) : p(std::move(n.p))
+	{  }
+	natural(container&& c) : p(std::move(c))
+	{  }
+#endif
 
 	const char* info() {
 	    static char buf[200];
@@ -466,7 +1084,12 @@ public:
 		(const natural&)
 		(atom)
 	*/
-	natural& set (const char* s); /* xbmath.cpp */
+	natural& set (const char* s) {
+	    return set_str(s,10);
+	}
+	/* Digits in base 2..36, either case; characters that are not
+	   digits of the base are skipped. */
+	natural& set_str(const char* s,int base = 10); // xbmath.cpp
 	natural& set (const natural& n) {
 	    p = n.p;
 	    return *this;
@@ -476,6 +1099,8 @@ public:
 	    p.insert(p.end(),t);
 	    return *this;
 	}
+	/* Exchanges the limbs, no copy. */
+	void	swap(natural& n) { p.swap(n.p); }
 	inline natural& zero() {
 	    return set((atom)0);
 	}
@@ -503,24 +1128,82 @@ public:
 	    return set((atom)1);
 	}
 
-	int	str_dec_length() const {
-	    return 1 + (( p.size() == 0 ? 1 : p.size() ) * sizeof(atom) * 8) / 3;
-	}
+	/* Digits in base, exact or one more (cheap); exact for
+	   powers of two. */
+	int	str_length(int base = 10) const {
+	    return p.size() ? (int)kernel::str_digits_max(&p[0],p.size(),base) : 1;
+	}
+	int	str_dec_length() const { return str_length(10); }
+	int	str_hex_length() const { return str_length(16); }
+	/* Exact number of digits, from the top atoms. */
+	int	str_digits(int base = 10) const {
+	    return p.size() ? (int)kernel::str_digits(&p[0],p.size(),base) : 1;
+	}
+	int	dec_digits() const { return str_digits(10); }
+	/* Estimates good to about 15 digits; -HUGE_VAL for zero. */
+	double	log2() const {
+	    return p.size() ? kernel::log2(&p[0],p.size()) : -HUGE_VAL;
+	}
+	double	log10() const { return log2() * 0.30102999566398119521; }
+	/* The first or last len digits (all if fewer; the last zero
+	   padded), NUL terminated in buf of len+1 characters, without
+	   converting the whole number; returns the digits written. */
+	int	leading_digits(char* buf,int len,int base = 10) const;	// xbmath.cpp
+	int	trailing_digits(char* buf,int len,int base = 10) const;	// xbmath.cpp
     public:
-	inline void	str_dec_new(char* buf,int max) const { str_dec(buf,max); }
+	/* Digits in base 2..36, lower case, truncated to max-1
+	   characters and NUL terminated. */
+	void	to_str(char* buf,int max,int base = 10) const; // xbmath.cpp
+	/* Same digits in pieces to w, zero padded to width. */
+	void	to_str(kernel::str_writer& w,int base = 10,int width = 0) const; // xbmath.cpp
+
+	/* Whole input of a FILE* or file descriptor as by set_str,
+	   converted while it is read; false on a read error. */
+	bool	read_file(FILE* f,int base = 10);	// xbmath.cpp
+	bool	read_fd(int fd,int base = 10);		// xbmath.cpp
+#ifndef XBM_NO_IOSTREAM
+	/* Digits up to the first other character, as operator >>
+	   reads an int. */
+	std::istream& read(std::istream& s,int base = 10);	// xbmath.cpp
+#endif
 
-	void	str_dec(char* buf,int max) const; // xbmath.cpp
+	/* Binary record: 16 byte header (magic, version, sign, limb
+	   width, endianness, limb count) and the raw limbs, least
+	   significant first; see xbmath.cpp. to_bin returns the bytes
+	   written, 0 if max is too small; set_bin the bytes used, 0
+	   if buf holds no valid record (this is then unchanged). */
+	size_t	bin_length() const;				// xbmath.cpp
+	/* The record to or from a file, without a buffer for all of
+	   it; false on an I/O error or no valid record. */
+	bool	write_bin(FILE* f) const;			// xbmath.cpp
+	bool	read_bin(FILE* f);				// xbmath.cpp
+
+	/* Limbs of a binary record file mapped copy on write: nothing
+	   is read up front and changes never reach the file. Records
+	   of other limbs are read and converted. */
+	bool	map_bin(const char* path);			// xbmath.cpp
+	/* Limbs kept in the file at path, read-write, for values
+	   larger than memory. With create the file gets the current
+	   value, otherwise the value is the record already there, if
+	   not negative. It holds the binary record of the value once
+	   unmapped. */
+	bool	map_file(const char* path,bool create = true);	// xbmath.cpp
+	void	unmap() { p.unmap(); }
+	bool	sync() { return p.sync(); }
+	size_t	to_bin(void* buf,size_t max) const;		// xbmath.cpp
+	size_t	set_bin(const void* buf,size_t len);		// xbmath.cpp
 
-	int	str_hex_length() const
-	{
-	    return p.size() * sizeof(atom)*2;
-	}
+	inline void	str_dec_new(char* buf,int max) const { str_dec(buf,max); }
 
-	void	str_hex(char* buf,int max) const; // xbmath.cpp
+	void	str_dec(char* buf,int max) const { to_str(buf,max,10); }
+	void	str_hex(char* buf,int max) const { to_str(buf,max,16); }
 
 	natural& inc();				  // xbmath.cpp  
 	natural& add (atom t);
 	natural& add (const natural& n);
+    protected:
+	natural& add_atoms(const atom* b,kernel::size_type bn);	// xbmath.cpp
+    public:
 	natural& mul (atom act);
 	natural& sqr (int n = 1);
 	natural& mul (const natural& n);
@@ -530,21 +1213,47 @@ public:
 
 	int cmp(const natural& n) const;
 
+	/* Division by one atom in place, returns the remainder. Pass
+	   a kernel::inverse_1 when dividing by the same atom often. */
+	atom div_1(const kernel::inverse_1& d);	// xbmath.cpp
+	atom mod_1(const kernel::inverse_1& d) const;	// xbmath.cpp
+	inline atom div_1(atom d) {
+	    return div_1(kernel::inverse_1(d));
+	}
+	inline atom mod_1(atom d) const {
+	    return mod_1(kernel::inverse_1(d));
+	}
+
+	/* Division known to leave no remainder (d divides this), e.g.
+	   by a GCD; cheaper than div. */
+	natural& divexact(const natural& d);	// xbmath.cpp
+
+	/* Quotient and remainder in one pass. Results may be the
+	   same objects as a or b. */
+	static void calc_div(
+	    const natural& a,
+	    const natural& b,
+		  natural& div_result,
+		  natural& mod_result);	// xbmath.cpp
+    protected:
+	static void divide(const natural& a,const natural& b,natural* q,natural* r); // xbmath.cpp
+    public:
+
 	void delete_zeroes();
 
 	unsigned largest_bit() const {
-	    return 
-		(p.size()-1)*atom_bits + 
-		(::xbmath::largest_bit( *(p.end()-1) ));
+	    return p.size() ? (unsigned)kernel::bit_length(&p[0],p.size()) : 0;
 	}
 	inline natural& mul10(int c = 1) {
-	    natural x;
+	    // multiply by largest power of 10 fitting in atom at once
+	    const int max_c = (atom_bits == 64) ? 19 : (atom_bits == 32) ? 9 : 4;
 	    while( c > 0 ) {
-		x.set(*this);
-		x.shift_left(3);
-		shift_left(1);
-		add(x);
-		--c;
+		int k = c < max_c ? c : max_c;
+		atom m = 10;
+		for( int i = 1; i < k; ++i )
+		    m *= 10;
+		mul(m);
+		c -= k;
 	    }
 	    return *this;
 	}
@@ -563,21 +1272,54 @@ public:
 		mul(i);
 	    return *this;
 	}
+	/* Same, resumable; see checkpoint. */
+	natural&    factorial(atom f,const checkpoint& c);	// xbmath.cpp
+	natural&    pow(unsigned long e,const checkpoint& c);	// xbmath.cpp
 
 	inline natural& operator = (atom t)		{ return set(t); }
 	inline natural& operator = (const natural& t)	{ return set(t); }
+#ifdef XBM_HAVE_MOVE
+	inline natural& operator = (natural&& t) {
+	    p = std::move(t.p);
+	    return *this;
+	}
+#endif
 
 	inline natural& operator *= (atom t) { return mul(t); }
 	inline natural& operator *= (const natural& n) { return mul(n); }
 	inline natural& operator += (atom t) { return add(t); }
 	inline natural& operator += (const natural& n) { return add(n); }
 
-	natural operator << (unsigned int c) const { return natural(*this).shift_left(c); }
-	natural operator >> (unsigned int c) const { return natural(*this).shift_right(c); }
-	natural operator <<=(unsigned int c)	{ return shift_left(c); }
-	natural operator >>=(unsigned int c)	{ return shift_right(c); }
-	natural operator +  (const natural& n) const { return natural(*this) += n; }
-	natural operator *  (const natural& n) const { return natural(*this) *= n; }
+	natural& operator <<=(unsigned int c)	{ return shift_left(c); }
+	natural& operator >>=(unsigned int c)	{ return shift_right(c); }
+	/* One copy of the left operand, returned without another. */
+	natural operator << (unsigned int c) const XBM_LVALUE_THIS {
+	    natural r(*this);
+	    r.shift_left(c);
+	    return r;
+	}
+	natural operator >> (unsigned int c) const XBM_LVALUE_THIS {
+	    natural r(*this);
+	    r.shift_right(c);
+	    return r;
+	}
+	natural operator +  (const natural& n) const XBM_LVALUE_THIS {
+	    natural r(*this);
+	    r.add(n);
+	    return r;
+	}
+	natural operator *  (const natural& n) const XBM_LVALUE_THIS {
+	    natural r(*this);
+	    r.mul(n);
+	    return r;
+	}
+#ifdef XBM_HAVE_MOVE
+	/* A temporary on the left is the result, as in a + b + c. */
+	natural operator << (unsigned int c) && { return std::move(shift_left(c)); }
+	natural operator >> (unsigned int c) && { return std::move(shift_right(c)); }
+	natural operator +  (const natural& n) && { return std::move(add(n)); }
+	natural operator *  (const natural& n) && { return std::move(mul(n)); }
+#endif
 	inline operator signed_atom () const {
 	    return (p.size() > 0) ? *p.begin() : (atom)0;
 	}
@@ -595,10 +1337,16 @@ public:
 	bool sign;
 	integer(signed_atom n = 0) : natural(n & ~last_bit),
 	    sign(n >= 0 ) {}
-	integer(const natural n,bool s = true) : natural(n),
+	integer(const natural& n,bool s = true) : natural(n),
 	    sign(s) { }
 	integer(const integer& i) : natural(i.p),
 	    sign(i.sign) {}
+#ifdef XBM_HAVE_MOVE
+	integer(natural&& n,bool s = true) : natural(std::move(n)),
+	    sign(s) { }
+	integer(integer&& i) : natural(std::move(i.p)),
+	    sign(i.sign) {}
+#endif
 
 	integer(const char* s) {
 	    set(s);
@@ -619,8 +1367,13 @@ public:
 	    return *this;
 	}
 	integer& set (const char* s) {
+	    return set_str(s,10);
+	}
+	integer& set_str(const char* s,int base = 10) {
 	    sign = (s) ? (*s == '-' ? (s++,false) :  true ): true;
-	    natural::set(s);
+	    natural::set_str(s,base);
+	    if( is_zero() )
+		sign = true;
 	    return *this;
 	}
 	integer& set (const natural& n) {
@@ -633,6 +1386,10 @@ public:
 	    sign = i.sign;
 	    return *this;
 	}
+	void	swap(integer& i) {
+	    p.swap(i.p);
+	    bool s = sign; sign = i.sign; i.sign = s;
+	}
 	// is one is inherited from natural
 	//inline bool is_one() const {
 	//   
@@ -646,6 +1403,8 @@ protected:
 	    return *this;
 	}
 	integer& sub_nc (const integer& x);
+	integer& sub_atoms(const atom* b,kernel::size_type bn);
+	integer& add_signed(const atom* b,kernel::size_type bn,bool s);
 	integer& div_nc(const integer& b);
 	inline	integer& mul_nc(const integer& i) {
 	    natural::mul(i);
@@ -660,15 +1419,40 @@ protected:
 	integer& dec_nc();
 
 
-public:	void	str_dec(char* buf,int max) 
+public:	int	str_length(int base = 10) const
 	{
-	    if( !sign ) {
+	    return natural::str_length(base) + !sign;
+	}
+	void	to_str(char* buf,int max,int base = 10) const
+	{
+	    if( !sign && buf != NULL && max > 1 ) {
 		*buf++ = '-';
-		*buf = '\0';
 		max--;
 	    }
-	    natural::str_dec(buf,max);
+	    natural::to_str(buf,max,base);
 	}
+	void	to_str(kernel::str_writer& w,int base = 10) const
+	{
+	    if( !sign )
+		w.write("-",1);
+	    natural::to_str(w,base);
+	}
+	/* As natural, with the sign in the record. */
+	size_t	to_bin(void* buf,size_t max) const;		// xbmath.cpp
+	size_t	set_bin(const void* buf,size_t len);		// xbmath.cpp
+	bool	map_bin(const char* path);			// xbmath.cpp
+	/* As natural; the file holds no sign, so a negative value is
+	   not mapped and the value mapped is positive. */
+	bool	map_file(const char* path,bool create = true);	// xbmath.cpp
+
+	/* As natural, with a leading '-' or '+'. */
+	bool	read_file(FILE* f,int base = 10);	// xbmath.cpp
+	bool	read_fd(int fd,int base = 10);		// xbmath.cpp
+#ifndef XBM_NO_IOSTREAM
+	std::istream& read(std::istream& s,int base = 10);	// xbmath.cpp
+#endif
+	void	str_dec(char* buf,int max) const { to_str(buf,max,10); }
+	void	str_hex(char* buf,int max) const { to_str(buf,max,16); }
 
 
 public: integer& add (int i) 
@@ -714,12 +1498,17 @@ public: integer& sub (const integer& i)
 	    else if( i.sign )	// ( (-a) - (+b) ) == (-|a| - |b| ) == -(|a| + |b|)
 		    add_nc(i);
 		else {		// ( (-a) - (-b) ) == ( -|a| + |b|) == -(|a| - |b|)
+		    sign = true;
 		    sub_nc(i);
 		    sign = !sign;
 		}
 	    return *this;
 	}
 
+	/* this + a*b and this - a*b, without a temporary number. */
+public:	integer& addmul(const integer& a,const integer& b);	// xbmath.cpp
+	integer& submul(const integer& a,const integer& b);	// xbmath.cpp
+
 public:	inline	integer& mul(const natural& i) {
 	    natural::mul(i);
 	    if( is_zero() )
@@ -750,6 +1539,26 @@ public:	integer& mod(const integer& i) {
 	    return *this;
 	}
 
+public:	integer& divexact(const integer& i) {
+	    natural::divexact(i);
+	    sign = is_zero() ? true : (sign == i.sign);
+	    return *this;
+	}
+
+public:	integer& div(atom d) {
+	    natural::div_1(d);
+	    if( is_zero() )
+		sign = true;
+	    return *this;
+	}
+
+public:	integer& mod(atom d) {
+	    natural::set(natural::mod_1(d));
+	    if( is_zero() )
+		sign = true;
+	    return *this;
+	}
+
 
 public:	integer& dec() {
 	    return sign ? dec_nc() : inc_nc();
@@ -801,6 +1610,11 @@ public: inline integer& pow(unsigned long c) {
 	    sign = (c & 1) ? sign : true;
 	    return *this;
 	}
+public: inline integer& pow(unsigned long c,const checkpoint& k) {
+	    natural::pow(c,k);
+	    sign = (c & 1) ? sign : true;
+	    return *this;
+	}
 public: inline integer& chs() {
 	    sign = !sign;
 	    return *this;
@@ -812,6 +1626,18 @@ public: inline integer& abs() {
 public:	inline integer& operator  = (signed_atom i) { return set(i); }
 	inline integer& operator  = (const natural& i) { return set(i); }
 	inline integer& operator  = (const integer& i) { return set(i); }
+#ifdef XBM_HAVE_MOVE
+	inline integer& operator  = (natural&& i) {
+	    p = std::move(i.p);
+	    sign = true;
+	    return *this;
+	}
+	inline integer& operator  = (integer&& i) {
+	    p = std::move(i.p);
+	    sign = i.sign;
+	    return *this;
+	}
+#endif
 
         inline integer& operator *= (int i) { return mul(integer(i)); }
 	inline integer& operator += (int i) { return add(i); }
@@ -822,17 +1648,27 @@ public:	inline integer& operator  = (signed_atom i) { return set(i); }
 	inline integer& operator *= (const integer& n) { return mul(n); }
 	inline integer& operator /= (const integer& n) { return div(n); }
 
-	integer operator <<= ( unsigned int c) { return shift_left(c); }
-	integer operator >>= ( unsigned int c) { return shift_right(c); }
-
-	inline integer operator + (const integer& b) const { return integer(*this).add(b); }
-	inline integer operator - (const integer& b) const { return integer(*this).sub(b); }
-	inline integer operator * (const integer& b) const { return integer(*this).mul(b); }
-	inline integer operator / (const integer& b) const { return integer(*this).div(b); }
-	inline integer operator % (const integer& b) const { return integer(*this).mod(b); }
-	inline integer operator - ()		     const { return integer(*this).chs();  }
-	inline integer operator << ( unsigned int c) const { return integer(*this).shift_left(c); }
-	inline integer operator >> ( unsigned int c) const { return integer(*this).shift_right(c); }
+	integer& operator <<= ( unsigned int c) { return shift_left(c); }
+	integer& operator >>= ( unsigned int c) { return shift_right(c); }
+
+	inline integer operator + (const integer& b) const XBM_LVALUE_THIS { integer r(*this); r.add(b); return r; }
+	inline integer operator - (const integer& b) const XBM_LVALUE_THIS { integer r(*this); r.sub(b); return r; }
+	inline integer operator * (const integer& b) const XBM_LVALUE_THIS { integer r(*this); r.mul(b); return r; }
+	inline integer operator / (const integer& b) const XBM_LVALUE_THIS { integer r(*this); r.div(b); return r; }
+	inline integer operator % (const integer& b) const XBM_LVALUE_THIS { integer r(*this); r.mod(b); return r; }
+	inline integer operator - ()		     const XBM_LVALUE_THIS { integer r(*this); r.chs(); return r; }
+	inline integer operator << ( unsigned int c) const XBM_LVALUE_THIS { integer r(*this); r.shift_left(c); return r; }
+	inline integer operator >> ( unsigned int c) const XBM_LVALUE_THIS { integer r(*this); r.shift_right(c); return r; }
+#ifdef XBM_HAVE_MOVE
+	inline integer operator + (const integer& b) && { return std::move(add(b)); }
+	inline integer operator - (const integer& b) && { return std::move(sub(b)); }
+	inline integer operator * (const integer& b) && { return std::move(mul(b)); }
+	inline integer operator / (const integer& b) && { return std::move(div(b)); }
+	inline integer operator % (const integer& b) && { return std::move(mod(b)); }
+	inline integer operator - ()		     && { return std::move(chs());  }
+	inline integer operator << ( unsigned int c) && { return std::move(shift_left(c)); }
+	inline integer operator >> ( unsigned int c) && { return std::move(shift_right(c)); }
+#endif
 
 	inline bool operator == (const integer& x) const { return cmp(x) == 0; };
 	inline bool operator != (const integer& x) const { return cmp(x) != 0; };
@@ -855,6 +1691,10 @@ public:
 	rational( const integer& _p,const integer& _q) : p(_p),q(_q) { }
 	rational( const integer& _p) : p(_p), q(1) { }
 	rational( const rational& r) : p(r.p), q(r.q) { }
+#ifdef XBM_HAVE_MOVE
+	rational( integer&& _p,integer&& _q) : p(std::move(_p)),q(std::move(_q)) { }
+	rational( rational&& r) : p(std::move(r.p)), q(std::move(r.q)) { }
+#endif
 	rational( const char* s) : p(1), q(1) { set(s); }
 
 	rational& set(double f = 0); //xbmath.h
@@ -886,6 +1726,10 @@ public:
 	    q = r.q;
 	    return *this;
 	}
+	void	swap(rational& r) {
+	    p.swap(r.p);
+	    q.swap(r.q);
+	}
 	rational&   expand(const integer& x) {
 	    p.mul(x);
 	    q.mul(x);
@@ -894,22 +1738,19 @@ public:
 	rational&   shrink() {
 	    integer result;
 
-	    while( integer::calc_GCD(result,p,q) ) {
-		p.div( result );
-		q.div( result );
+	    // after dividing by the GCD p and q are coprime
+	    if( integer::calc_GCD(result,p,q) ) {
+		p.divexact( result );
+		q.divexact( result );
 	    }
 	    return *this;
 	}
 	rational& add(const integer& i) {
-	    integer x = i;
-	    x *= q;
-	    p += x;
+	    p.addmul(i,q);
 	    return *this;
 	}
 	rational& sub(const integer& i) {
-	    integer x = i;
-	    x *= q;
-	    p -= x;
+	    p.submul(i,q);
 	    return *this;
 	}
 	rational& mul(const integer& i) {
@@ -921,20 +1762,18 @@ public:
 	    return *this;
 	}
 	rational& add(const rational& r) {
-	    integer t;
+	    if( &r == this )
+		return mul2();
 	    p *= r.q;
-	    t = r.p;
-	    t *= q;
-	    p += t;
+	    p.addmul(r.p,q);
 	    q *= r.q;
 	    return *this;
 	}
 	rational& sub(const rational& r) {
-	    integer t;
+	    if( &r == this )
+		return zero();
 	    p *= r.q;
-	    t = r.p;
-	    t *= q;
-	    p -= t;
+	    p.submul(r.p,q);
 	    q *= r.q;
 	    return *this;
 	}
@@ -1028,6 +1867,14 @@ public:
 
 public:	int	str_dec_length(int prec = 4) const;
 public:	char*	str_dec(char* buf,int max,int prec = 4) const;
+	/* Decimal digits with prec digits after the point, in
+	   pieces to w. */
+public:	void	to_str(kernel::str_writer& w,int prec = 4) const; // xbmath.cpp
+
+	/* Binary records of p and q, as natural::to_bin. */
+public:	size_t	bin_length() const;				// xbmath.cpp
+public:	size_t	to_bin(void* buf,size_t max) const;		// xbmath.cpp
+public:	size_t	set_bin(const void* buf,size_t len);		// xbmath.cpp
 
 private:static  void insert_string_at(char* dest,int dest_len,int max,int at,const char* src);
 
@@ -1044,20 +1891,40 @@ public:
 
 	inline rational& operator  = (const integer& i) { return set(i); }
 	inline rational& operator  = (const rational& r){ return set(r); }
+#ifdef XBM_HAVE_MOVE
+	inline rational& operator  = (rational&& r) {
+	    p = std::move(r.p);
+	    q = std::move(r.q);
+	    return *this;
+	}
+#endif
 	inline rational& operator  = (const char* s)	{ return set(s); }
 	inline rational& operator  = (float f)		{ return set(f); }
 
-	inline rational  operator +  (const rational& r) const { return rational(*this).add(r); }
-	inline rational  operator -  (const rational& r) const { return rational(*this).sub(r); }
-	inline rational  operator *  (const rational& r) const { return rational(*this).mul(r); }
-	inline rational  operator /  (const rational& r) const { return rational(*this).div(r); }
-
-	inline rational  operator +  (const integer& i) const { return rational(*this).add(i); }
-	inline rational  operator -  (const integer& i) const { return rational(*this).sub(i); }
-	inline rational  operator *  (const integer& i) const { return rational(*this).mul(i); }
-	inline rational  operator /  (const integer& i) const { return rational(*this).div(i); }
-
-	inline rational operator - () const { return rational(*this).chs();  }
+	inline rational  operator +  (const rational& r) const XBM_LVALUE_THIS { rational x(*this); x.add(r); return x; }
+	inline rational  operator -  (const rational& r) const XBM_LVALUE_THIS { rational x(*this); x.sub(r); return x; }
+	inline rational  operator *  (const rational& r) const XBM_LVALUE_THIS { rational x(*this); x.mul(r); return x; }
+	inline rational  operator /  (const rational& r) const XBM_LVALUE_THIS { rational x(*this); x.div(r); return x; }
+
+	inline rational  operator +  (const integer& i) const XBM_LVALUE_THIS { rational x(*this); x.add(i); return x; }
+	inline rational  operator -  (const integer& i) const XBM_LVALUE_THIS { rational x(*this); x.sub(i); return x; }
+	inline rational  operator *  (const integer& i) const XBM_LVALUE_THIS { rational x(*this); x.mul(i); return x; }
+	inline rational  operator /  (const integer& i) const XBM_LVALUE_THIS { rational x(*this); x.div(i); return x; }
+
+	inline rational operator - () const XBM_LVALUE_THIS { rational x(*this); x.chs(); return x; }
+#ifdef XBM_HAVE_MOVE
+	inline rational  operator +  (const rational& r) && { return std::move(add(r)); }
+	inline rational  operator -  (const rational& r) && { return std::move(sub(r)); }
+	inline rational  operator *  (const rational& r) && { return std::move(mul(r)); }
+	inline rational  operator /  (const rational& r) && { return std::move(div(r)); }
+
+	inline rational  operator +  (const integer& i) && { return std::move(add(i)); }
+	inline rational  operator -  (const integer& i) && { return std::move(sub(i)); }
+	inline rational  operator *  (const integer& i) && { return std::move(mul(i)); }
+	inline rational  operator /  (const integer& i) && { return std::move(div(i)); }
+
+	inline rational operator - () && { return std::move(chs());  }
+#endif
 
 	inline bool operator == (const rational& r) const { return cmp(r) == 0; };
 	inline bool operator != (const rational& r) const { return cmp(r) != 0; };
@@ -1076,39 +1943,66 @@ public:
     }; // xbmath:: rational
 
 #ifndef XBM_NO_IOSTREAM
+    /* Base selected by the hex and oct flags of a stream. */
+    inline int stream_base(const std::ios_base& s)
+    {
+	return (s.flags() & std::ios::hex) ? 16 :
+	       (s.flags() & std::ios::oct) ? 8 : 10;
+    }
+
+    /* Digits straight into the stream; only when the stream pads to
+       a width are they collected first, to know their length. */
+    class ostream_writer : public kernel::str_writer {
+    public:
+	ostream_writer(std::ostream& s) : s(s), pad(s.width() > 0) {}
+	void write(const char* b,kernel::size_type len)
+	{
+	    if( pad )
+		t.append(b,len);
+	    else
+		s.write(b,len);
+	}
+	std::ostream& finish()
+	{
+	    if( pad )
+		s << t;
+	    return s;
+	}
+    private:
+	std::ostream& s;
+	bool pad;
+	string t;
+    };
+
 inline std::ostream& operator << (std::ostream& s, const xbmath::natural& n)
 {
-    if( s.flags() & std::ios::hex ) {
-	int max = n.str_hex_length()+1;
-	char* buf = new char[max+1];
-	memset(buf,0,max+1);
-	n.str_hex(buf,max);
-	s << buf;
-	delete [] buf;
-    } else {
-	int max = n.str_dec_length()+1;
-	char* buf = new char [max+1];
-	memset(buf,0,max+1);
-	n.str_dec(buf,max);
-	s << buf;
-	delete [] buf;
-    }
-    return s;
+    ostream_writer w(s);
+    n.to_str(w,stream_base(s));
+    return w.finish();
 }
 
 inline std::ostream& operator << (std::ostream& s, const integer& i)
 {
-    if( ! i.sign )
-	s << '-';
-    return s << (const natural)i;
+    ostream_writer w(s);
+    i.to_str(w,stream_base(s));
+    return w.finish();
 }
 
 inline std::ostream& operator << (std::ostream& s, const rational& r)
 {
-    char* buf = r.str_dec(NULL, 0 ,s.precision());
-    s << buf;
-    delete [] buf;
-    return s;
+    ostream_writer w(s);
+    r.to_str(w,(int)s.precision());
+    return w.finish();
+}
+
+inline std::istream& operator >> (std::istream& s, xbmath::natural& n)
+{
+    return n.read(s,stream_base(s));
+}
+
+inline std::istream& operator >> (std::istream& s, integer& i)
+{
+    return i.read(s,stream_base(s));
 }
 #endif // XBM_NO_IOSTREAM
     
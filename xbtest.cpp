@@ -0,0 +1,678 @@
+/*
+* File		: xbtest.cpp
+* Language	: C++
+* Description	: Checks of xbmath against reference code, run by
+		  "make check".
+*
+    Every algorithm is run with its thresholds forced low and high
+    and compared with schoolbook code or digit at a time conversion;
+    numbers are taken through their text and binary forms and back.
+    Prints the first failures and exits nonzero if there were any.
+*/
+
+#include "xbmath.h"
+#include <string>
+#include <sstream>
+#if __cplusplus >= 201103L
+#include <thread>
+#include <utility>
+#endif
+
+typedef xbmath::atom atom;
+typedef xbmath::kernel kernel;
+typedef xbmath::kernel::size_type size_type;
+using xbmath::natural;
+using xbmath::integer;
+using xbmath::rational;
+
+static int failures = 0;
+static int checks = 0;
+
+static void check(bool ok,const char* what,long a = 0,long b = 0)
+{
+    ++checks;
+    if( ok )
+	return;
+    if( ++failures <= 20 )
+	printf("FAIL %s (%ld %ld)\n",what,a,b);
+}
+
+/* xorshift64*, fixed seed so failures repeat */
+static unsigned long long rnd_state = 88172645463325252ULL;
+
+static atom rnd()
+{
+    rnd_state ^= rnd_state >> 12;
+    rnd_state ^= rnd_state << 25;
+    rnd_state ^= rnd_state >> 27;
+    return (atom)(rnd_state * 2685821657736338717ULL);
+}
+
+static size_type rnd(size_type n)
+/* 1 to n */
+{
+    return 1 + (size_type)(rnd() % n);
+}
+
+static void rnd_atoms(atom* a,size_type n)
+/* runs of zeros and all ones among the random atoms make carries */
+{
+    for( size_type i = 0; i < n; ++i ) {
+	switch( rnd() % 8 ) {
+	case 0:	a[i] = 0; break;
+	case 1:	a[i] = ~(atom)0; break;
+	default: a[i] = rnd();
+	}
+    }
+    if( n && a[n-1] == 0 )
+	a[n-1] = 1;
+}
+
+typedef std::vector<atom> atoms;
+
+static atoms rnd_atoms(size_type n)
+{
+    atoms a(n);
+    rnd_atoms(&a[0],n);
+    return a;
+}
+
+static void test_kernel()
+/* sub undoes add, submul_1 undoes addmul_1 */
+{
+    for( int i = 0; i < 200; ++i ) {
+	size_type n = rnd(40);
+	atoms a = rnd_atoms(n);
+	atoms b = rnd_atoms(n);
+	atoms s(n), d(n);
+	atom c = kernel::add_n(&s[0],&a[0],&b[0],n);
+	check(kernel::sub_n(&d[0],&s[0],&b[0],n) == c && d == a,"add_n/sub_n",(long)n);
+	const atom m = rnd();
+	atoms p(n), z(n,0), t(b);
+	atom h = kernel::mul_1(&p[0],&a[0],n,m);
+	check(kernel::addmul_1(&z[0],&a[0],n,m) == h && z == p,"mul_1/addmul_1",(long)n);
+	h = kernel::addmul_1(&t[0],&a[0],n,m);
+	check(kernel::submul_1(&t[0],&a[0],n,m) == h && t == b,"addmul_1/submul_1",(long)n);
+    }
+}
+
+static void set_mul(size_type k,size_type t3,size_type t4,size_type fft)
+{
+    kernel::karatsuba_threshold = kernel::sqr_karatsuba_threshold = k;
+    kernel::toom3_threshold = kernel::sqr_toom3_threshold = t3;
+    kernel::toom4_threshold = kernel::sqr_toom4_threshold = t4;
+    kernel::fft_threshold = kernel::sqr_fft_threshold = fft;
+}
+
+enum { never = 1000000000 };
+
+static void test_mul()
+/* products by every algorithm against the schoolbook ones */
+{
+    for( int i = 0; i < 100; ++i ) {
+	size_type an = rnd(60);
+	size_type bn = rnd(an);
+	atoms a = rnd_atoms(an);
+	atoms b = rnd_atoms(bn);
+	atoms r(an + bn);
+	atoms s(an + bn,0);
+	kernel::mul_basecase(&r[0],&a[0],an,&b[0],bn);
+	for( size_type j = 0; j < bn; ++j )
+	    s[an + j] = kernel::addmul_1(&s[j],&a[0],an,b[j]);
+	check(r == s,"mul_basecase",(long)an,(long)bn);
+    }
+    static const size_type cfg[][4] = {
+	{ 32, 150, 400, 10000 },	// defaults
+	{ 2, 6, 12, never },		// Karatsuba, Toom on small pieces
+	{ 3, 3, never, never },		// Toom-3 only
+	{ 3, 3, 3, never },		// Toom-4 only
+	{ 3, 3, 3, 3 },			// NTT wherever it is built in
+    };
+    for( size_t c = 0; c < sizeof cfg / sizeof cfg[0]; ++c ) {
+	set_mul(cfg[c][0],cfg[c][1],cfg[c][2],cfg[c][3]);
+	for( int i = 0; i < 150; ++i ) {
+	    size_type an = rnd(i < 120 ? 80 : 600);
+	    size_type bn = rnd(an);
+	    atoms a = rnd_atoms(an);
+	    atoms b = rnd_atoms(bn);
+	    atoms r(an + bn);
+	    atoms s(an + bn);
+	    kernel::mul_basecase(&r[0],&a[0],an,&b[0],bn);
+	    kernel::mul(&s[0],&a[0],an,&b[0],bn);
+	    check(r == s,"mul",(long)c,(long)an);
+	    atoms q(2*an);
+	    atoms t(2*an);
+	    kernel::mul_basecase(&q[0],&a[0],an,&a[0],an);
+	    kernel::sqr(&t[0],&a[0],an);
+	    check(q == t,"sqr",(long)c,(long)an);
+	    kernel::sqr_basecase(&t[0],&a[0],an);
+	    check(q == t,"sqr_basecase",(long)c,(long)an);
+	}
+    }
+    set_mul(32,150,400,10000);
+}
+
+static void test_div()
+/*
+    quotient and remainder satisfy a = q*d + r, r < d, and match
+    Knuth D for every split of the work
+*/
+{
+    static const size_type cfg[][2] = {
+	{ never, never },	// Knuth D only
+	{ 4, never },		// Burnikel-Ziegler
+	{ 60, 30000 },		// defaults
+	{ 4, 8 },		// Newton inverse
+    };
+    for( int i = 0; i < 200; ++i ) {
+	size_type dn = rnd(i < 150 ? 40 : 200);
+	size_type an = dn - 1 + rnd(i & 1 ? 8*dn : dn);
+	atoms a = rnd_atoms(an);
+	atoms d = rnd_atoms(dn);
+	atoms q0, r0;
+	for( size_t c = 0; c < sizeof cfg / sizeof cfg[0]; ++c ) {
+	    kernel::div_bz_threshold = cfg[c][0];
+	    kernel::div_newton_threshold = cfg[c][1];
+	    atoms q(an - dn + 1);
+	    atoms r(dn);
+	    kernel::divrem(&q[0],&r[0],&a[0],an,&d[0],dn);
+	    check(kernel::cmp(&r[0],&d[0],dn) < 0,"divrem r < d",(long)c,(long)dn);
+	    atoms t(an + 1,0);
+	    kernel::mul_basecase(&t[0],&q[0],q.size(),&d[0],dn);
+	    kernel::add(&t[0],&t[0],t.size(),&r[0],dn);
+	    check(kernel::cmp(&t[0],&a[0],an) == 0 && t[an] == 0,"divrem a = q*d + r",(long)c,(long)an);
+	    if( c == 0 ) {
+		q0 = q;
+		r0 = r;
+	    } else
+		check(q == q0 && r == r0,"divrem matches Knuth D",(long)c,(long)an);
+	}
+    }
+    kernel::div_bz_threshold = 60;
+    kernel::div_newton_threshold = 30000;
+
+    // one atom divisors, with and without the inverse
+    for( int i = 0; i < 200; ++i ) {
+	size_type an = rnd(60);
+	atoms a = rnd_atoms(an);
+	atom d = rnd() >> (rnd() % xbmath::atom_bits);
+	if( d == 0 )
+	    d = 1;
+	kernel::inverse_1 inv(d);
+	atoms q(an), q1(an), t(an);
+	atom r = kernel::divrem_1(&q[0],&a[0],an,d);
+	atom h = kernel::mul_1(&t[0],&q[0],an,d);
+	h += kernel::add_1(&t[0],&t[0],an,r);
+	check(r < d && h == 0 && t == a,"divrem_1 a = q*d + r",(long)an);
+	check(kernel::divrem_1(&q1[0],&a[0],an,inv) == r && q1 == q,"divrem_1 by inverse",(long)an);
+	check(kernel::mod_1(&a[0],an,inv) == r,"mod_1",(long)an);
+    }
+
+    // exact division, Hensel from below and by divrem
+    for( int i = 0; i < 200; ++i ) {
+	size_type qn = rnd(i < 150 ? 40 : 300);
+	size_type dn = rnd(i < 150 ? 40 : 300);
+	atoms q = rnd_atoms(qn);
+	atoms d = rnd_atoms(dn);
+	if( i & 1 )
+	    d[0] &= ~(atom)7;	// even divisors shift first
+	if( d[0] == 0 && dn == 1 )
+	    d[0] = 2;
+	atoms a(qn + dn);
+	kernel::mul_basecase(&a[0],&q[0],qn,&d[0],dn);
+	size_type an = kernel::normalize(&a[0],a.size());
+	for( int c = 0; c < 2; ++c ) {
+	    kernel::divexact_threshold = c ? 2 : never;
+	    atoms r(an - dn + 1);
+	    kernel::divexact(&r[0],&a[0],an,&d[0],dn);
+	    r.resize(kernel::normalize(&r[0],r.size()));
+	    check(r == q,"divexact",c,(long)an);
+	}
+    }
+    kernel::divexact_threshold = 150;
+}
+
+static std::string ref_str(const atom* a,size_type n,int base)
+/* digits by dividing by the base, half an atom at a time */
+{
+    const unsigned half = xbmath::atom_bits / 2;
+    const atom low = ((atom)1 << half) - 1;
+    atoms t(a,a + n);
+    std::string s;
+    n = kernel::normalize(a,n);
+    while( n > 0 ) {
+	atom r = 0;
+	for( size_type i = n; i-- > 0; ) {
+	    atom h = (r << half) | (t[i] >> half);
+	    atom qh = h / base;
+	    r = h % base;
+	    atom l = (r << half) | (t[i] & low);
+	    t[i] = (qh << half) | (l / base);
+	    r = l % base;
+	}
+	s += "0123456789abcdefghijklmnopqrstuvwxyz"[r];
+	n = kernel::normalize(&t[0],n);
+    }
+    if( s.empty() )
+	s = "0";
+    return std::string(s.rbegin(),s.rend());
+}
+
+class str_collect : public kernel::str_writer {
+public:
+    std::string s;
+    void write(const char* p,size_type len) { s.append(p,len); }
+};
+
+static void test_radix()
+/* conversions against ref_str */
+{
+    for( int i = 0; i < 240; ++i ) {
+	const int base = 2 + i % 35;
+	size_type n = rnd(i < 175 ? 12 : 160);
+	atoms a = rnd_atoms(n);
+	const std::string ref = ref_str(&a[0],n,base);
+	for( int c = 0; c < 2; ++c ) {
+	    kernel::str_dc_threshold = c ? 2 : never;
+	    std::vector<char> s(kernel::str_digits_max(&a[0],n,base));
+	    size_type len = kernel::to_str(&s[0],&a[0],n,base);
+	    check(std::string(&s[0],len) == ref,"to_str",base,c);
+	    const bool pow2 = (base & (base - 1)) == 0;
+	    check(len == s.size() || (len + 1 == s.size() && !pow2),"str_digits_max",base,(long)n);
+	    str_collect w;
+	    kernel::to_str(w,&a[0],n,base);
+	    check(w.s == ref,"to_str pieces",base,c);
+	    atoms r(kernel::str_atoms_max(ref.size(),base));
+	    size_type rn = kernel::from_str(&r[0],ref.data(),ref.size(),base);
+	    r.resize(rn);
+	    check(r == a,"from_str",base,c);
+	}
+	kernel::str_dc_threshold = 20;
+
+	kernel::str_reader rd(base);
+	for( size_type k = 0; k < ref.size(); ) {
+	    size_type m = rnd(ref.size() - k);
+	    rd.put(ref.data() + k,m);
+	    k += m;
+	}
+	xbmath::container r;
+	rd.get(r);
+	check(kernel::normalize(&r[0],r.size()) == n && std::equal(a.begin(),a.end(),r.begin()),"str_reader",base,(long)n);
+
+	check(kernel::str_digits(&a[0],n,base) == ref.size(),"str_digits",base,(long)n);
+	size_type k = rnd(ref.size() + 4);
+	std::vector<char> t(k + 1);
+	size_type tn = kernel::str_leading(&t[0],&a[0],n,k,base);
+	check(std::string(&t[0],tn) == ref.substr(0,k),"str_leading",base,(long)k);
+	tn = kernel::str_trailing(&t[0],&a[0],n,k,base);
+	check(std::string(&t[0],tn) == (k < ref.size() ? ref.substr(ref.size() - k) : ref),"str_trailing",base,(long)k);
+    }
+
+    // buffers with no room beyond the terminating NUL
+    for( int i = 0; i < 3; ++i ) {
+	char s[3] = { 'x', 'x', 'x' };
+	natural n((xbmath::container()));	// zero with no limbs
+	if( i )
+	    n.set(i == 1 ? 0 : 12);
+	n.to_str(s,1);
+	check(s[0] == '\0' && s[1] == 'x',"to_str max 1",i);
+	n.to_str(s,2);
+	check(s[0] == (i == 2 ? '1' : '0') && s[1] == '\0' && s[2] == 'x',"to_str max 2",i);
+    }
+}
+
+static integer rnd_integer(size_type n)
+{
+    atoms a = rnd_atoms(rnd(n));
+    integer x(natural(xbmath::container(&a[0],&a[0] + a.size())));
+    if( rnd() & 1 )
+	x.chs();
+    return x;
+}
+
+static bool negative(const integer& x)
+{
+    return x < integer((xbmath::signed_atom)0);
+}
+
+static std::string dec(const integer& x)
+{
+    std::vector<char> s(x.str_length() + 2);
+    x.str_dec(&s[0],(int)s.size());
+    return &s[0];
+}
+
+static void test_numbers()
+/* signed arithmetic identities and round trips */
+{
+    for( int i = 0; i < 300; ++i ) {
+	integer a = rnd_integer(i < 250 ? 12 : 100);
+	integer b = rnd_integer(i < 250 ? 12 : 100);
+
+	// quotient and remainder both get the sign a.sign == b.sign
+	integer q(a);
+	q.div(b);
+	integer r(a);
+	r.mod(b);
+	const bool same = negative(a) == negative(b);
+	check((q.is_zero() || negative(q) != same) && (r.is_zero() || negative(r) != same),"div and mod sign",i);
+	integer aa(a), rb(b), t(q);
+	aa.abs();
+	rb.abs();
+	t.abs();
+	t.mul(rb);
+	r.abs();
+	t.add(r);
+	check(t == aa && r < rb,"|a| = |a/b|*|b| + |a%b|",i);
+
+	integer g;
+	integer::calc_GCD(g,a,b);
+	integer x(a), y(b);
+	x.mod(g);
+	y.mod(g);
+	integer h, ag(a), bg(b);
+	ag.div(g);
+	bg.div(g);
+	integer::calc_GCD(h,ag,bg);
+	check(x.is_zero() && y.is_zero() && h.is_one() && !(g < integer(1)),"gcd",i);
+
+	integer c = rnd_integer(12);
+	integer m(c), p(a);
+	p.mul(b);
+	m.addmul(a,b);
+	integer s(c);
+	s.add(p);
+	check(m == s,"addmul",i);
+	m = c;
+	m.submul(a,b);
+	s = c;
+	s.sub(p);
+	check(m == s,"submul",i);
+
+	// text, signed
+	integer u;
+	u.set_str(dec(a).c_str());
+	check(u == a,"str_dec/set_str",i);
+	const int base = 2 + i % 35;
+	std::vector<char> buf(a.str_length(base) + 2);
+	a.to_str(&buf[0],(int)buf.size(),base);
+	integer v;
+	v.set_str(&buf[0],base);
+	check(v == a,"to_str/set_str",i,base);
+
+	// binary records
+	std::vector<unsigned char> bin(a.bin_length());
+	check(a.to_bin(&bin[0],bin.size()) == bin.size(),"integer to_bin",i);
+	integer w;
+	check(w.set_bin(&bin[0],bin.size()) == bin.size() && w == a,"integer set_bin",i);
+
+	rational f(a,b);	// q keeps its sign
+	std::vector<unsigned char> rb2(f.bin_length());
+	check(f.to_bin(&rb2[0],rb2.size()) == rb2.size(),"rational to_bin",i);
+	rational e;
+	check(e.set_bin(&rb2[0],rb2.size()) == rb2.size() && e == f,"rational set_bin",i);
+    }
+    rational f(1);
+    f.div(integer(-3));
+    std::vector<unsigned char> rbin(f.bin_length());
+    f.to_bin(&rbin[0],rbin.size());
+    rational e;
+    check(e.set_bin(&rbin[0],rbin.size()) == rbin.size() && e == f,"rational set_bin, negative q");
+
+    integer z;
+    std::vector<unsigned char> bin(z.bin_length());
+    z.to_bin(&bin[0],bin.size());
+    integer w(7);
+    check(w.set_bin(&bin[0],bin.size()) != 0 && w.is_zero(),"set_bin zero");
+}
+
+#if __cplusplus >= 201103L
+static void test_move()
+/* moved from numbers can be assigned again */
+{
+    integer a = rnd_integer(50);
+    integer b(a);
+    integer c(std::move(b));
+    check(c == a,"move construct");
+    b = std::move(c);
+    check(b == a,"move assign");
+    c = a;
+    check(c == a,"assign after move");
+    rational f(a,integer(3)), g(f);
+    rational h(std::move(g));
+    check(h == f,"rational move");
+}
+#endif
+
+static void test_files()
+/* numbers through files */
+{
+    const char* path = "xbtest.tmp";
+    integer a = rnd_integer(300);
+    a.abs();
+
+    FILE* f = tmpfile();
+    if( f ) {
+	std::string s = dec(a);
+	fputs(s.c_str(),f);
+	rewind(f);
+	integer b;
+	check(b.read_file(f) && b == a,"read_file");
+	fclose(f);
+    }
+
+    // a minus sign does not make zero negative
+    integer z;
+    z.set_str("-0");
+    check(z.is_zero() && !negative(z) && dec(z) == "0","set_str -0");
+    f = tmpfile();
+    if( f ) {
+	fputs("-000",f);
+	rewind(f);
+	integer b(5);
+	check(b.read_file(f) && !negative(b) && dec(b) == "0","read_file -0");
+	fclose(f);
+    }
+#ifndef XBM_NO_IOSTREAM
+    std::istringstream in("-0 ");
+    integer c(5);
+    in >> c;
+    check(!in.fail() && !negative(c) && dec(c) == "0","operator>> -0");
+#endif
+
+    f = tmpfile();
+    check(f != NULL && a.write_bin(f),"write_bin");
+    if( f ) {
+	rewind(f);
+	integer b;
+	check(b.read_bin(f) && b == a,"read_bin");
+	fclose(f);
+    }
+
+    f = fopen(path,"wb");
+    if( f ) {
+	a.write_bin(f);
+	fclose(f);
+	natural b;
+	check(b.map_bin(path) && b == a,"map_bin");
+	b.add(1);	// private map: the file stays as it was
+	natural c;
+	check(c.map_bin(path) && c == a,"map_bin copy on write");
+    }
+    {
+	natural b(a);
+	check(b.map_file(path,true),"map_file create");
+	b.mul(b);
+	b.unmap();
+	natural c;
+	check(c.map_bin(path) && c == b,"map_file keeps the value");
+	natural d;
+	check(d.map_file(path,false) && d == b,"map_file reopen");
+	d.unmap();
+    }
+    {
+	// shared maps hold no sign
+	integer b(a);
+	b.chs();
+	check(!b.map_file(path,true),"map_file create, negative");
+	std::vector<unsigned char> bin(b.bin_length());
+	b.to_bin(&bin[0],bin.size());
+	f = fopen(path,"wb");
+	if( f ) {
+	    fwrite(&bin[0],1,bin.size(),f);
+	    fclose(f);
+	}
+	natural c;
+	check(!c.map_file(path,false),"map_file reopen, negative record");
+	integer d(b);
+	check(!d.map_file(path,false) && d == b,"integer map_file, negative record");
+	f = fopen(path,"wb");
+	if( f ) {
+	    a.write_bin(f);
+	    fclose(f);
+	}
+	integer e(-5);
+	check(e.map_file(path,false) && e == a,"integer map_file");
+	e.unmap();
+    }
+    remove(path);
+
+    natural p(3), q(3);
+    p.pow(5000);
+    q.pow(5000,xbmath::checkpoint(path,0));
+    check(p == q,"pow with checkpoint");
+    p.factorial(3000);
+    q.factorial(3000,xbmath::checkpoint(path,0));
+    check(p == q,"factorial with checkpoint");
+    integer n(-7), o(-7);
+    n.pow(301);
+    o.pow(301,xbmath::checkpoint(path,0));
+    check(n == o,"integer pow with checkpoint");
+
+    // checkpoints with a position out of range are not resumed
+    p.factorial(300);
+    for( int i = 0; i < 2; ++i ) {
+	unsigned char h[32] = { 'X', 'B', 'M', 'C', 1, 1 };
+	const unsigned long long at = i ? 300 + 5 : 0;
+	for( int k = 0; k < 8; ++k ) {
+	    h[8 + k] = (unsigned char)(300ULL >> (8*k));
+	    h[16 + k] = (unsigned char)(at >> (8*k));
+	}
+	f = fopen(path,"wb");
+	if( f ) {
+	    fwrite(h,1,sizeof h,f);
+	    natural(1).write_bin(f);
+	    fclose(f);
+	}
+	q.factorial(300,xbmath::checkpoint(path,0));
+	check(p == q,"factorial, checkpoint out of range",i);
+    }
+    remove(path);
+}
+
+static void test_memory()
+/* results do not depend on where the limbs come from */
+{
+    integer a = rnd_integer(200);
+    integer b = rnd_integer(150);
+    integer r(a);
+    r.mul(b);
+    r.div(integer(12345));
+    {
+	xbmath::arena ar;
+	xbmath::memory_scope s(&ar);
+	integer t(a);
+	t.mul(b);
+	t.div(integer(12345));
+	check(t == r,"arena");
+    }
+    {
+	xbmath::pool pl;
+	xbmath::memory_scope s(&pl);
+	integer t(a);
+	t.mul(b);
+	t.div(integer(12345));
+	check(t == r,"pool");
+    }
+    integer p(a);
+    p.mul(b);
+    integer p1(p), p2(p);
+    p1.add(integer(1));
+    p2.mul(p);
+    {
+	xbmath::memory_scope s(&xbmath::shared_limbs::resource);
+	integer t(a);
+	t.mul(b);
+	integer u(t), v, w(t);
+	v = t;
+	u.add(integer(1));
+	v.mul(v);
+	w.sub(t);
+	check(t == p && u == p1 && v == p2 && w.is_zero(),"shared limbs");
+
+	// a shared map swaps values in place, not into a block it shares
+	natural f(u), x(v), y(v), z(u);
+	check(f.map_file("xbtest.tmp",true),"map_file, shared limbs");
+	f.swap(x);
+	check(f == y && x == z,"swap with a shared map");
+	f.unmap();
+	remove("xbtest.tmp");
+    }
+}
+
+#if __cplusplus >= 201103L
+static void convert_loop(int t,int* bad)
+{
+    std::string s = "9";
+    for( int i = 0; i < 2000 + 500*t; ++i )
+	s += char('0' + (i*7 + t) % 10);
+    integer x(s.c_str());
+    for( int r = 0; r < 6; ++r ) {
+	int base = 3 + (t*5 + r) % 34;
+	if( (base & (base - 1)) == 0 )
+	    ++base;
+	std::vector<char> buf(x.str_length(base) + 2);
+	x.to_str(&buf[0],(int)buf.size(),base);
+	integer y;
+	y.set_str(&buf[0],base);
+	if( y != x || dec(x) != s )
+	    ++*bad;
+    }
+}
+
+static void test_threads()
+/* the radix caches grow in several threads at once */
+{
+    kernel::str_dc_threshold = 4;
+    kernel::div_newton_threshold = 8;
+    std::vector<std::thread> th;
+    int bad[8] = { 0 };
+    for( int t = 0; t < 8; ++t )
+	th.push_back(std::thread(convert_loop,t,bad + t));
+    for( size_t t = 0; t < th.size(); ++t )
+	th[t].join();
+    for( int t = 0; t < 8; ++t )
+	check(bad[t] == 0,"conversion in threads",t);
+    kernel::str_dc_threshold = 20;
+    kernel::div_newton_threshold = 30000;
+}
+#endif
+
+int main()
+{
+    test_kernel();
+    test_mul();
+    test_div();
+    test_radix();
+    test_numbers();
+#if __cplusplus >= 201103L
+    test_move();
+#endif
+    test_files();
+    test_memory();
+#if __cplusplus >= 201103L
+    test_threads();
+#endif
+    printf("%d checks, %d failed\n",checks,failures);
+    return failures ? 1 : 0;
+}